@@ -0,0 +1,291 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "alloc.h"
+
+#include <stdio.h>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Let AddressSanitizer catch uses of freed cells
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#else
+#define ASAN_POISON_MEMORY_REGION(P, N) ((void)(P), (void)(N))
+#define ASAN_UNPOISON_MEMORY_REGION(P, N) ((void)(P), (void)(N))
+#endif
+
+#define PAGE_SIZE (64 * 1024)
+#define GRANULE 16
+#define CLASSES (SLAB_MAX_SIZE / GRANULE)
+
+typedef struct Page Page;
+
+struct Page {
+    Page *next, *prev; // nursery pages of the same class with free cells
+    Page *all_next, *all_prev; // pages of the same generation
+    void *base;        // what to give back to the OS
+    void *free;        // cells that have been freed
+    char *bump, *end;  // cells never handed out yet
+    unsigned size;     // cell size
+    unsigned cells;    // how many cells fit
+    unsigned live;
+    int partial;       // in the class's list of pages with free cells
+    int young;         // in the nursery
+    int age;           // collections survived mostly full
+};
+
+#define FIRST_CELL(P) ((char *)(P) + ((sizeof(Page) + GRANULE - 1) & ~(GRANULE - 1)))
+#define PAGE_OF(P) ((Page *)((uintptr_t)(P) & ~(uintptr_t)(PAGE_SIZE - 1)))
+
+// A free cell is marked as such and links to the next one after the mark
+#define NEXT_FREE(P) (((void **)(P))[1])
+
+// Nursery pages are filled by new objects and scanned by minor collections.
+// Pages that stay mostly full of survivors for PROMOTE_AGE collections are
+// promoted to the old generation, which is never allocated from. An old page
+// that has mostly been freed again is handed back to the nursery.
+#define PROMOTE_AGE 3
+#define FULL(P) ((P)->live > (P)->cells / 4 * 3)
+#define DEMOTE(P) ((P)->live <= (P)->cells / 4)
+
+// Nursery pages with free cells for each size class
+static Page *partial[CLASSES];
+
+// Every page of each generation, for slab_each
+static Page *young_pages = NULL;
+static Page *old_pages = NULL;
+
+int slab_release_pages = 0;
+size_t slab_live = 0;
+size_t slab_young = 0;
+
+static void *map_pages(void **base) {
+#ifdef __unix__
+    // Map twice the size so the page can be aligned to its size, then trim
+    char *p = mmap(NULL, 2 * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) abort();
+
+    char *aligned = (char *)(((uintptr_t)p + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1));
+    if (aligned > p) munmap(p, aligned - p);
+    munmap(aligned + PAGE_SIZE, p + PAGE_SIZE - aligned);
+
+    *base = aligned;
+    return aligned;
+#else
+    char *p = malloc(2 * PAGE_SIZE);
+    if (p == NULL) abort();
+
+    *base = p;
+    return (void *)(((uintptr_t)p + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1));
+#endif
+}
+
+static void link_page(Page **list, Page *page) {
+    page->all_prev = NULL;
+    page->all_next = *list;
+    if (*list) (*list)->all_prev = page;
+    *list = page;
+}
+
+static void unlink_page(Page **list, Page *page) {
+    if (page->all_prev) page->all_prev->all_next = page->all_next;
+    else *list = page->all_next;
+    if (page->all_next) page->all_next->all_prev = page->all_prev;
+}
+
+static void unmap_page(Page *page) {
+    unlink_page(page->young ? &young_pages : &old_pages, page);
+
+#ifdef __unix__
+    munmap(page->base, PAGE_SIZE);
+#else
+    free(page->base);
+#endif
+}
+
+static void link_partial(Page *page, int cls) {
+    page->prev = NULL;
+    page->next = partial[cls];
+    if (partial[cls]) partial[cls]->prev = page;
+    partial[cls] = page;
+    page->partial = 1;
+}
+
+static void unlink_partial(Page *page, int cls) {
+    if (page->prev) page->prev->next = page->next;
+    else partial[cls] = page->next;
+    if (page->next) page->next->prev = page->prev;
+    page->partial = 0;
+}
+
+static Page *new_page(int cls) {
+    void *base;
+    Page *page = map_pages(&base);
+
+    page->base = base;
+    page->free = NULL;
+    page->size = (cls + 1) * GRANULE;
+    page->bump = FIRST_CELL(page);
+    page->end = (char *)page + PAGE_SIZE;
+    page->cells = (page->end - page->bump) / page->size;
+    page->live = 0;
+    page->young = 1;
+    page->age = 0;
+
+    link_page(&young_pages, page);
+    link_partial(page, cls);
+    return page;
+}
+
+void *slab_alloc(size_t size) {
+    int cls = (size + GRANULE - 1) / GRANULE - 1;
+    Page *page = partial[cls];
+    void *p;
+
+    if (page == NULL) page = new_page(cls);
+
+    if (page->free != NULL) {
+        p = page->free;
+        ASAN_UNPOISON_MEMORY_REGION(p, page->size);
+        page->free = NEXT_FREE(p);
+    } else {
+        p = page->bump;
+        page->bump += page->size;
+    }
+    page->live += 1;
+    slab_live += 1;
+    slab_young += 1;
+
+    if (page->free == NULL && page->bump + page->size > page->end) {
+        unlink_partial(page, cls);
+    }
+
+    return p;
+}
+
+void slab_free(void *p) {
+    Page *page = PAGE_OF(p);
+    int cls = page->size / GRANULE - 1;
+
+    *(unsigned *)p = SLAB_FREE;
+    NEXT_FREE(p) = page->free;
+    page->free = p;
+    page->live -= 1;
+    slab_live -= 1;
+    // Leave the mark and link readable for slab_each
+    ASAN_POISON_MEMORY_REGION((char *)p + 2 * sizeof(void *), page->size - 2 * sizeof(void *));
+
+    if (!page->young) {
+        if (page->live == 0 && slab_release_pages) {
+            unmap_page(page);
+        } else if (DEMOTE(page)) {
+            unlink_page(&old_pages, page);
+            link_page(&young_pages, page);
+            page->young = 1;
+            page->age = 0;
+            slab_young += page->live;
+            link_partial(page, cls);
+        }
+        return;
+    }
+
+    slab_young -= 1;
+    if (!page->partial) link_partial(page, cls);
+
+    // Keep the last page of a class around, it would be needed again soon
+    if (page->live == 0 && slab_release_pages && (page->prev || page->next)) {
+        unlink_partial(page, cls);
+        unmap_page(page);
+    }
+}
+
+void slab_promote(void) {
+    Page *next;
+
+    for (Page *page = young_pages; page != NULL; page = next) {
+        next = page->all_next;
+
+        if (page->live == 0) {
+            // Start bumping from the top again, the free list is all of it
+            ASAN_UNPOISON_MEMORY_REGION(FIRST_CELL(page), page->end - FIRST_CELL(page));
+            page->free = NULL;
+            page->bump = FIRST_CELL(page);
+        } else if (!FULL(page)) {
+            page->age = 0;
+        } else if (++page->age >= PROMOTE_AGE) {
+            unlink_page(&young_pages, page);
+            link_page(&old_pages, page);
+            page->young = 0;
+            slab_young -= page->live;
+            if (page->partial) unlink_partial(page, page->size / GRANULE - 1);
+        }
+    }
+}
+
+static void each_cell(Page *pages, void (*fn)(void *cell)) {
+    for (Page *page = pages; page != NULL; page = page->all_next) {
+        for (char *cell = FIRST_CELL(page); cell < page->bump; cell += page->size) {
+            if (*(unsigned *)cell == SLAB_FREE) continue;
+            fn(cell);
+        }
+    }
+}
+
+void slab_each(void (*fn)(void *cell)) {
+    each_cell(young_pages, fn);
+    each_cell(old_pages, fn);
+}
+
+void slab_each_young(void (*fn)(void *cell)) {
+    each_cell(young_pages, fn);
+}
+
+const void *map_file(const char *path, size_t *size) {
+#ifdef __unix__
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    *size = st.st_size;
+    return data;
+#else
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    unsigned char *data = len > 0 ? malloc(len) : NULL;
+    if (data != NULL && fread(data, 1, len, f) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+
+    *size = len;
+    return data;
+#endif
+}
+
+void unmap_file(const void *data, size_t size) {
+#ifdef __unix__
+    munmap((void *)data, size);
+#else
+    free((void *)data);
+#endif
+}
@@ -0,0 +1,40 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+// Slab allocator for small, fixed size objects (Values and call frames).
+// Objects of each 16 byte size class are carved out of their own page aligned
+// chunks, so freeing needs no size and neighbours share cache lines.
+
+#define SLAB_MAX_SIZE 256
+
+// The first 4 bytes of a free cell, objects must never start with this
+#define SLAB_FREE 0xffffffffu
+
+void *slab_alloc(size_t size);
+void slab_free(void *p);
+
+// Calls fn on every allocated cell. fn must not allocate or free cells.
+void slab_each(void (*fn)(void *cell));
+
+// Same, for the cells in nursery pages only
+void slab_each_young(void (*fn)(void *cell));
+
+// Call after collecting the nursery: pages that kept mostly full move to the
+// old generation, empty ones go back to bump allocation
+void slab_promote(void);
+
+// When set, chunks that become empty are given back to the OS
+extern int slab_release_pages;
+
+// Number of cells currently allocated, and of those in the nursery
+extern size_t slab_live;
+extern size_t slab_young;
+
+// The contents of the file at path, mapped read-only where possible. NULL if
+// it can't be read or is empty.
+const void *map_file(const char *path, size_t *size);
+void unmap_file(const void *data, size_t size);
+
+#endif
@@ -0,0 +1,409 @@
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bigint.h"
+
+// Magnitudes are arrays of 32 bit limbs so a product of two fits in a
+// uint64_t. Products of operands with at least this many limbs each use
+// Karatsuba's method: three half size products instead of four.
+#define KARATSUBA_THRESHOLD 32
+
+// The largest power of ten in a limb, for converting to and from decimal
+#define DECIMAL_BASE 1000000000u
+#define DECIMAL_DIGITS 9
+
+BigInt *create_bigint(size_t len, int neg) {
+    BigInt *a = malloc(sizeof *a + len * sizeof a->limbs[0]);
+    a->len = len;
+    a->neg = neg;
+    return a;
+}
+
+void free_bigint(BigInt *a) {
+    free(a);
+}
+
+BigInt *copy_bigint(const BigInt *a) {
+    size_t size = sizeof *a + a->len * sizeof a->limbs[0];
+    return memcpy(malloc(size), a, size);
+}
+
+// Drops the leading zero limbs, 0 is never negative
+static BigInt *trim(BigInt *a) {
+    while (a->len > 0 && a->limbs[a->len - 1] == 0) a->len--;
+    if (a->len == 0) a->neg = 0;
+    return a;
+}
+
+BigInt *bigint_from_ll(long long x) {
+    unsigned long long mag = x < 0 ? -(unsigned long long)x : (unsigned long long)x;
+    BigInt *a = create_bigint(2, x < 0);
+    a->limbs[0] = (uint32_t)mag;
+    a->limbs[1] = (uint32_t)(mag >> 32);
+    return trim(a);
+}
+
+BigInt *bigint_from_double(double x) {
+    int exp;
+    double m = frexp(fabs(x), &exp);
+
+    // |x| = mantissa * 2^shift with a 53 bit integer mantissa
+    uint64_t mantissa = (uint64_t)ldexp(m, 53);
+    int shift = exp - 53;
+    if (shift < 0) {
+        mantissa >>= -shift;
+        shift = 0;
+    }
+
+    BigInt *a = create_bigint(shift / 32 + 3, x < 0);
+    memset(a->limbs, 0, a->len * sizeof a->limbs[0]);
+
+    size_t at = shift / 32;
+    int bits = shift % 32;
+    a->limbs[at] = (uint32_t)(mantissa << bits);
+    a->limbs[at + 1] = (uint32_t)(mantissa >> (32 - bits));
+    a->limbs[at + 2] = bits ? (uint32_t)(mantissa >> (64 - bits)) : 0;
+    return trim(a);
+}
+
+// a = a * mul + add over len limbs, returns the carry out
+static uint32_t mul_small(uint32_t *a, size_t len, uint32_t mul, uint32_t add) {
+    uint64_t carry = add;
+    for (size_t i = 0; i < len; i++) {
+        uint64_t t = (uint64_t)a[i] * mul + carry;
+        a[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    return (uint32_t)carry;
+}
+
+// a = a / div over len limbs, returns the remainder
+static uint32_t div_small(uint32_t *q, const uint32_t *a, size_t len, uint32_t div) {
+    uint64_t rem = 0;
+    for (size_t i = len; i-- > 0;) {
+        uint64_t cur = rem << 32 | a[i];
+        q[i] = (uint32_t)(cur / div);
+        rem = cur % div;
+    }
+    return (uint32_t)rem;
+}
+
+BigInt *parse_bigint(const char *digits, size_t len, int neg) {
+    // Every 9 digits take less than a limb
+    BigInt *a = create_bigint(len / DECIMAL_DIGITS + 1, neg);
+    size_t used = 0;
+
+    // The first chunk takes what is left over, the rest are 9 digits each
+    size_t chunk = len % DECIMAL_DIGITS ? len % DECIMAL_DIGITS : DECIMAL_DIGITS;
+    for (size_t i = 0; i < len; i += chunk, chunk = DECIMAL_DIGITS) {
+        uint32_t value = 0, scale = 1;
+        for (size_t j = 0; j < chunk; j++) {
+            value = value * 10 + (digits[i + j] - '0');
+            scale *= 10;
+        }
+
+        uint32_t carry = mul_small(a->limbs, used, scale, value);
+        if (carry) a->limbs[used++] = carry;
+    }
+
+    a->len = used;
+    return trim(a);
+}
+
+int bigint_to_ll(const BigInt *a, long long *x) {
+    if (a->len > 2) return 0;
+
+    unsigned long long mag = 0;
+    for (size_t i = a->len; i-- > 0;) mag = mag << 32 | a->limbs[i];
+
+    if (a->neg) {
+        if (mag > (unsigned long long)LLONG_MAX + 1) return 0;
+        *x = mag == (unsigned long long)LLONG_MAX + 1 ? LLONG_MIN : -(long long)mag;
+    } else {
+        if (mag > LLONG_MAX) return 0;
+        *x = mag;
+    }
+    return 1;
+}
+
+double bigint_to_double(const BigInt *a) {
+    double x = 0;
+    for (size_t i = a->len; i-- > 0;) x = x * 4294967296.0 + a->limbs[i];
+    return a->neg ? -x : x;
+}
+
+char *bigint_to_string(const BigInt *a) {
+    // Each limb gives less than 10 digits, plus the sign and NUL
+    size_t size = a->len * 10 + 2;
+    char *str = malloc(size), *p = str + size;
+    uint32_t *q = malloc((a->len + 1) * sizeof *q);
+    size_t len = a->len;
+
+    memcpy(q, a->limbs, len * sizeof *q);
+    *--p = 0;
+    do {
+        uint32_t chunk = div_small(q, q, len, DECIMAL_BASE);
+        while (len > 0 && q[len - 1] == 0) len--;
+
+        // All 9 digits but those of the most significant chunk
+        for (int i = 0; i < DECIMAL_DIGITS && (len > 0 || chunk > 0 || i == 0); i++) {
+            *--p = '0' + chunk % 10;
+            chunk /= 10;
+        }
+    } while (len > 0);
+    if (a->neg) *--p = '-';
+
+    memmove(str, p, str + size - p);
+    free(q);
+    return str;
+}
+
+// Magnitudes
+
+static int cmp_mag(const uint32_t *a, size_t alen, const uint32_t *b, size_t blen) {
+    if (alen != blen) return alen < blen ? -1 : 1;
+    for (size_t i = alen; i-- > 0;) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// r += a, where r has room for the carry
+static void add_into(uint32_t *r, size_t rlen, const uint32_t *a, size_t alen) {
+    uint64_t carry = 0;
+    size_t i;
+    for (i = 0; i < alen; i++) {
+        uint64_t t = (uint64_t)r[i] + a[i] + carry;
+        r[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    for (; carry && i < rlen; i++) {
+        carry = ++r[i] == 0;
+    }
+}
+
+// r -= a, where r >= a
+static void sub_into(uint32_t *r, size_t rlen, const uint32_t *a, size_t alen) {
+    uint64_t borrow = 0;
+    size_t i;
+    for (i = 0; i < alen; i++) {
+        uint64_t t = (uint64_t)r[i] - a[i] - borrow;
+        r[i] = (uint32_t)t;
+        borrow = t >> 63;
+    }
+    for (; borrow && i < rlen; i++) {
+        borrow = r[i]-- == 0;
+    }
+}
+
+static void mul_basic(uint32_t *r, const uint32_t *a, size_t alen, const uint32_t *b, size_t blen) {
+    memset(r, 0, (alen + blen) * sizeof *r);
+    for (size_t i = 0; i < blen; i++) {
+        uint64_t carry = 0, y = b[i];
+        if (y == 0) continue;
+
+        for (size_t j = 0; j < alen; j++) {
+            uint64_t t = a[j] * y + r[i + j] + carry;
+            r[i + j] = (uint32_t)t;
+            carry = t >> 32;
+        }
+        r[i + alen] = (uint32_t)carry;
+    }
+}
+
+// r[0, alen + blen) = a * b
+static void mul_mag(uint32_t *r, const uint32_t *a, size_t alen, const uint32_t *b, size_t blen) {
+    if (alen < blen) {
+        const uint32_t *t = a;
+        a = b;
+        b = t;
+        size_t tlen = alen;
+        alen = blen;
+        blen = tlen;
+    }
+
+    if (blen < KARATSUBA_THRESHOLD) {
+        mul_basic(r, a, alen, b, blen);
+        return;
+    }
+
+    if (alen >= 2 * blen) {
+        // Too lopsided to split evenly, multiply b by each blen limbs of a
+        uint32_t *t = malloc(2 * blen * sizeof *t);
+        memset(r, 0, (alen + blen) * sizeof *r);
+        for (size_t i = 0; i < alen; i += blen) {
+            size_t n = alen - i < blen ? alen - i : blen;
+            mul_mag(t, a + i, n, b, blen);
+            add_into(r + i, alen + blen - i, t, n + blen);
+        }
+        free(t);
+        return;
+    }
+
+    // a = a1 B^m + a0 and b = b1 B^m + b0, and b1 isn't empty since blen > m:
+    // a b = z2 B^2m + z1 B^m + z0 where z0 = a0 b0, z2 = a1 b1 and
+    // z1 = (a0 + a1)(b0 + b1) - z0 - z2
+    size_t m = alen / 2, a1len = alen - m, b1len = blen - m;
+    const uint32_t *a0 = a, *a1 = a + m, *b0 = b, *b1 = b + m;
+
+    mul_mag(r, a0, m, b0, m);
+    mul_mag(r + 2 * m, a1, a1len, b1, b1len);
+
+    // a1len >= m, so a1 is the longer half of a
+    size_t salen = a1len + 1, sblen = (b1len > m ? b1len : m) + 1;
+    uint32_t *sa = calloc(salen + sblen, sizeof *sa), *sb = sa + salen;
+    memcpy(sa, a1, a1len * sizeof *sa);
+    add_into(sa, salen, a0, m);
+    if (b1len > m) {
+        memcpy(sb, b1, b1len * sizeof *sb);
+        add_into(sb, sblen, b0, m);
+    } else {
+        memcpy(sb, b0, m * sizeof *sb);
+        add_into(sb, sblen, b1, b1len);
+    }
+
+    size_t zlen = salen + sblen;
+    uint32_t *z1 = malloc(zlen * sizeof *z1);
+    mul_mag(z1, sa, salen, sb, sblen);
+    sub_into(z1, zlen, r, 2 * m);
+    sub_into(z1, zlen, r + 2 * m, a1len + b1len);
+
+    // z1 = a0 b1 + a1 b0 < B^(alen + blen - m), the rest are zeros
+    while (zlen > alen + blen - m) zlen--;
+    add_into(r + m, alen + blen - m, z1, zlen);
+
+    free(sa);
+    free(z1);
+}
+
+// q = a / b and rem = a % b, where alen >= blen and q has alen - blen + 1
+// limbs, rem blen. Knuth's algorithm D.
+static void divmod_mag(uint32_t *q, uint32_t *rem, const uint32_t *a, size_t alen, const uint32_t *b, size_t blen) {
+    if (blen == 1) {
+        rem[0] = div_small(q, a, alen, b[0]);
+        return;
+    }
+
+    // Shift both so the top bit of b is set, which keeps the estimates of
+    // each quotient limb off by at most 2
+    int s = __builtin_clz(b[blen - 1]);
+    uint32_t *bn = malloc((blen + alen + 1) * sizeof *bn), *an = bn + blen;
+
+    for (size_t i = blen - 1; i > 0; i--) {
+        bn[i] = (uint32_t)(b[i] << s | (uint64_t)b[i - 1] >> (32 - s));
+    }
+    bn[0] = b[0] << s;
+    an[alen] = (uint32_t)((uint64_t)a[alen - 1] >> (32 - s));
+    for (size_t i = alen - 1; i > 0; i--) {
+        an[i] = (uint32_t)(a[i] << s | (uint64_t)a[i - 1] >> (32 - s));
+    }
+    an[0] = a[0] << s;
+
+    for (size_t j = alen - blen + 1; j-- > 0;) {
+        uint64_t top = (uint64_t)an[j + blen] << 32 | an[j + blen - 1];
+        uint64_t qhat = top / bn[blen - 1], rhat = top % bn[blen - 1];
+
+        while (qhat >> 32 || qhat * bn[blen - 2] > (rhat << 32 | an[j + blen - 2])) {
+            qhat--;
+            rhat += bn[blen - 1];
+            if (rhat >> 32) break;
+        }
+
+        // an -= qhat * bn, shifted j limbs
+        uint64_t carry = 0, borrow = 0, t;
+        for (size_t i = 0; i < blen; i++) {
+            uint64_t p = qhat * bn[i] + carry;
+            carry = p >> 32;
+            t = (uint64_t)an[i + j] - (uint32_t)p - borrow;
+            an[i + j] = (uint32_t)t;
+            borrow = t >> 63;
+        }
+        t = (uint64_t)an[j + blen] - carry - borrow;
+        an[j + blen] = (uint32_t)t;
+
+        q[j] = (uint32_t)qhat;
+        if (t >> 63) {
+            // qhat was one too many, add bn back
+            q[j]--;
+            carry = 0;
+            for (size_t i = 0; i < blen; i++) {
+                t = (uint64_t)an[i + j] + bn[i] + carry;
+                an[i + j] = (uint32_t)t;
+                carry = t >> 32;
+            }
+            an[j + blen] += (uint32_t)carry;
+        }
+    }
+
+    for (size_t i = 0; i < blen; i++) {
+        rem[i] = (uint32_t)(an[i] >> s | (uint64_t)an[i + 1] << (32 - s));
+    }
+    free(bn);
+}
+
+// Signed arithmetic
+
+// |a| + |b| if add, else |a| - |b|, with the sign of a
+static BigInt *add_signed(const BigInt *a, const BigInt *b, int add) {
+    if (add) {
+        const BigInt *big = a->len >= b->len ? a : b, *small = big == a ? b : a;
+        BigInt *r = create_bigint(big->len + 1, a->neg);
+        memcpy(r->limbs, big->limbs, big->len * sizeof r->limbs[0]);
+        r->limbs[big->len] = 0;
+        add_into(r->limbs, r->len, small->limbs, small->len);
+        return trim(r);
+    }
+
+    int c = cmp_mag(a->limbs, a->len, b->limbs, b->len);
+    const BigInt *big = c >= 0 ? a : b, *small = big == a ? b : a;
+    BigInt *r = create_bigint(big->len, c >= 0 ? a->neg : !a->neg);
+    memcpy(r->limbs, big->limbs, big->len * sizeof r->limbs[0]);
+    sub_into(r->limbs, r->len, small->limbs, small->len);
+    return trim(r);
+}
+
+BigInt *bigint_add(const BigInt *a, const BigInt *b) {
+    return add_signed(a, b, a->neg == b->neg);
+}
+
+BigInt *bigint_sub(const BigInt *a, const BigInt *b) {
+    return add_signed(a, b, a->neg != b->neg);
+}
+
+BigInt *bigint_mul(const BigInt *a, const BigInt *b) {
+    if (a->len == 0 || b->len == 0) return create_bigint(0, 0);
+
+    BigInt *r = create_bigint(a->len + b->len, a->neg != b->neg);
+    mul_mag(r->limbs, a->limbs, a->len, b->limbs, b->len);
+    return trim(r);
+}
+
+// The quotient if want_rem is 0, else the remainder
+static BigInt *divmod(const BigInt *a, const BigInt *b, int want_rem) {
+    if (cmp_mag(a->limbs, a->len, b->limbs, b->len) < 0) {
+        return want_rem ? copy_bigint(a) : create_bigint(0, 0);
+    }
+
+    BigInt *q = create_bigint(a->len - b->len + 1, a->neg != b->neg);
+    BigInt *r = create_bigint(b->len, a->neg);
+    divmod_mag(q->limbs, r->limbs, a->limbs, a->len, b->limbs, b->len);
+
+    free_bigint(want_rem ? q : r);
+    return trim(want_rem ? r : q);
+}
+
+BigInt *bigint_div(const BigInt *a, const BigInt *b) {
+    return divmod(a, b, 0);
+}
+
+BigInt *bigint_rem(const BigInt *a, const BigInt *b) {
+    return divmod(a, b, 1);
+}
+
+int bigint_cmp(const BigInt *a, const BigInt *b) {
+    if (a->neg != b->neg) return a->neg ? -1 : 1;
+
+    int c = cmp_mag(a->limbs, a->len, b->limbs, b->len);
+    return a->neg ? -c : c;
+}
@@ -0,0 +1,48 @@
+#ifndef BIGINT_H
+#define BIGINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Arbitrary precision integers, for the results of integer arithmetic that
+// don't fit in a long long. Each is one malloc'ed block, freed with
+// free_bigint(). The functions here never change their arguments.
+
+typedef struct BigInt {
+    size_t len; // limbs in use, the most significant one is never 0
+    int neg;
+    uint32_t limbs[]; // least significant first
+} BigInt;
+
+// Uninitialized limbs, for the image and FASL readers
+BigInt *create_bigint(size_t len, int neg);
+void free_bigint(BigInt *a);
+BigInt *copy_bigint(const BigInt *a);
+
+BigInt *bigint_from_ll(long long x);
+
+// x must be finite and have no fraction
+BigInt *bigint_from_double(double x);
+
+// The decimal digits [digits, digits + len)
+BigInt *parse_bigint(const char *digits, size_t len, int neg);
+
+// Returns 0 if a doesn't fit in a long long
+int bigint_to_ll(const BigInt *a, long long *x);
+double bigint_to_double(const BigInt *a);
+
+// Decimal, malloc'ed
+char *bigint_to_string(const BigInt *a);
+
+BigInt *bigint_add(const BigInt *a, const BigInt *b);
+BigInt *bigint_sub(const BigInt *a, const BigInt *b);
+BigInt *bigint_mul(const BigInt *a, const BigInt *b);
+
+// Truncating like C's / and %, b must not be 0
+BigInt *bigint_div(const BigInt *a, const BigInt *b);
+BigInt *bigint_rem(const BigInt *a, const BigInt *b);
+
+// Negative, 0 or positive as a is less than, equal to or greater than b
+int bigint_cmp(const BigInt *a, const BigInt *b);
+
+#endif
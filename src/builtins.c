@@ -3,20 +3,30 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include "alloc.h"
 #include "builtins.h"
 #include "env.h"
+#include "expand.h"
+#include "gc.h"
+#include "hash.h"
+#include "hashtable.h"
 #include "interpreter.h"
+#include "numvector.h"
+#include "symbol.h"
 
 #define ARITH_POS(OPER, INIT) \
 static Value *bltn_ ## OPER(Value *args, Env *env) { \
-    Number total = create_number_ll(INIT); \
+    Number total = create_number_ll(INIT), next; \
     \
     while (args != NULL) { \
-        assert(args->type == TYPE_LIST); \
+        assert(TYPEOF(args) == TYPE_LIST); \
         if (TYPEOF(car(args)) != TYPE_NUMBER) { \
+           free_number(total); \
            return create_exception("Can only perform arithmetic on numbers"); \
         } \
-        total = OPER ## _number(total, car(args)->value.number); \
+        next = OPER ## _number(total, number_of(car(args))); \
+        free_number(total); \
+        total = next; \
         args = cdr(args); \
     } \
     \
@@ -26,43 +36,71 @@ static Value *bltn_ ## OPER(Value *args, Env *env) { \
 ARITH_POS(add, 0)
 ARITH_POS(mul, 1)
 
-#define ARITH_NEG(OPER, INIT) \
+#define ARITH_NEG(OPER, INIT, DIVIDES) \
 static Value *bltn_ ## OPER(Value *args, Env *env) { \
-    Number total; \
+    Number total, next; \
     \
     if (TYPEOF(car(args)) != TYPE_NUMBER) { \
        return create_exception("First argument to - or / must be number"); \
     } \
     \
-    total = car(args)->value.number; \
+    total = number_of(car(args)); \
     args = cdr(args); \
     \
     /* special case unary */ \
     if (args == NULL) { \
+        if (DIVIDES && divides_by_zero(create_number_ll(INIT), total)) { \
+            return create_exception("Division by zero"); \
+        } \
         return create_number(OPER ## _number(create_number_ll(INIT), total)); \
     } \
     \
+    total = copy_number(total); \
     while (args != NULL) { \
-        assert(args->type == TYPE_LIST); \
+        assert(TYPEOF(args) == TYPE_LIST); \
         if (TYPEOF(car(args)) != TYPE_NUMBER) { \
+           free_number(total); \
            return create_exception("Can only perform arithmetic on numbers"); \
         } \
-        total = OPER ## _number(total, car(args)->value.number); \
+        if (DIVIDES && divides_by_zero(total, number_of(car(args)))) { \
+           free_number(total); \
+           return create_exception("Division by zero"); \
+        } \
+        next = OPER ## _number(total, number_of(car(args))); \
+        free_number(total); \
+        total = next; \
         args = cdr(args); \
     } \
     \
     return create_number(total); \
 }
 
-ARITH_NEG(sub, 0)
-ARITH_NEG(div, 1)
-ARITH_NEG(rem, 0)
+ARITH_NEG(sub, 0, 0)
+ARITH_NEG(div, 1, 1)
+ARITH_NEG(rem, 0, 1)
 
 // FIXME
 static Value *quote(Value *args, Env *env) {
     return copy_value(car(args));
 }
 
+// Returns the number of frame slots the operands need, or -1 if invalid
+int count_slots(Value *operands) {
+    static Value *rest = NULL;
+    if (rest == NULL) rest = intern("&rest");
+
+    int slots = 0;
+    for (Value *op = operands; op != NULL; op = cdr(op)) {
+        if (car(op) == rest) {
+            // &rest must be followed by exactly one name
+            return TYPEOF(car(cdr(op))) == TYPE_ATOM && cdr(cdr(op)) == NULL
+                ? slots + 1 : -1;
+        }
+        slots += 1;
+    }
+    return slots;
+}
+
 Value *validate_lambda_arguments(Value *operands, const char *expr) {
     // Validate arguments
     if (!IS_LIST(operands)) {
@@ -76,6 +114,10 @@ Value *validate_lambda_arguments(Value *operands, const char *expr) {
             }
         }
     }
+
+    if (count_slots(operands) < 0) {
+        return create_exception("&rest must be followed by name");
+    }
     return NULL;
 }
 
@@ -85,10 +127,16 @@ Value *make_func(Value *operands, Value *body, enum Type type, Env *env, const c
     err = validate_lambda_arguments(operands, func_name);
     if (err) return err;
 
+    // Macros are called in the caller's environment, so only their own
+    // parameters have a fixed address
+    resolve_lexical(body, operands, type != TYPE_FUNCTION_SF ? env : NULL);
+    if (type == TYPE_MACRO) macro_count += 1;
+
     func = create_value(type);
     func->value.func.operands = copy_value(operands);
     func->value.func.body = copy_value(body);
     func->value.func.env = copy_env(env);
+    func->nslots = count_slots(operands);
     return func;
 }
 
@@ -105,7 +153,7 @@ static Value *WHICH(Value *args, Env *env) { \
         value = make_func(operands, body, TYPE_FUNCTION, env, #WHICH); \
         if (TYPEOF(value) == TYPE_EXCEPTION) return value; \
     } else { \
-        value = eval(car(cdr(args)), env); \
+        value = eval_car(cdr(args), env); \
     }\
     \
     /* Validate arguments */ \
@@ -114,7 +162,7 @@ static Value *WHICH(Value *args, Env *env) { \
         return create_exception("Name in " #WHICH " expression can only be an atom"); \
     } \
     \
-    FUNC(env, name->value.atom, value); \
+    FUNC(env, name, value); \
     \
     return NULL; \
 }
@@ -144,9 +192,98 @@ static Value *macro(Value *args, Env *env) {
     return make_func(operands, body, TYPE_FUNCTION_SF, env, "macro");
 }
 
+// (define-macro (name params...) body): calls to name are replaced by the
+// value of body, with the params bound to their unevaluated operands
+static Value *define_macro(Value *args, Env *env) {
+    Value *name = car(car(args));
+
+    if (TYPEOF(car(args)) != TYPE_LIST || TYPEOF(name) != TYPE_ATOM) {
+        return create_exception("define-macro must start with (name params...)");
+    } else if (cdr(args) == NULL) {
+        return create_exception("define-macro must have a body");
+    }
+
+    Value *value = make_func(cdr(car(args)), car(cdr(args)), TYPE_MACRO, env, "define-macro");
+    if (TYPEOF(value) == TYPE_EXCEPTION) return value;
+
+    add_to_env(env, name, value);
+    return NULL;
+}
+
+static Value *quasi(Value *x, int level, Env *env);
+
+// The items of a template list, with ,@ items spliced in
+static Value *quasi_items(Value *ls, int level, Env *env) {
+    static Value *unquote_splicing = NULL;
+    if (unquote_splicing == NULL) unquote_splicing = intern("unquote-splicing");
+
+    Value *ret = NULL, **next = &ret;
+
+    for (; ls != NULL; ls = cdr(ls)) {
+        Value *item = car(ls);
+
+        if (level == 1 && TYPEOF(item) == TYPE_LIST && CAR(item) == unquote_splicing
+                && cdr(item) != NULL) {
+            Value *spliced = eval_car(CDR(item), env);
+
+            if (TYPEOF(spliced) == TYPE_EXCEPTION) {
+                delete_value(ret);
+                return spliced;
+            } else if (!IS_LIST(spliced)) {
+                delete_value(spliced);
+                delete_value(ret);
+                return create_exception("unquote-splicing expects a list");
+            }
+
+            for (Value *s = spliced; s != NULL; s = cdr(s)) {
+                *next = cons(copy_value(car(s)), NULL);
+                next = &CDR(*next);
+            }
+            delete_value(spliced);
+            continue;
+        }
+
+        Value *v = quasi(item, level, env);
+        if (TYPEOF(v) == TYPE_EXCEPTION) {
+            delete_value(ret);
+            return v;
+        }
+        *next = cons(v, NULL);
+        next = &CDR(*next);
+    }
+
+    return ret;
+}
+
+// x with its parts unquoted at the given nesting level replaced by their
+// values
+static Value *quasi(Value *x, int level, Env *env) {
+    static Value *quasiquote = NULL, *unquote;
+    if (quasiquote == NULL) {
+        quasiquote = intern("quasiquote");
+        unquote = intern("unquote");
+    }
+
+    if (TYPEOF(x) != TYPE_LIST) return copy_value(x);
+
+    if (CAR(x) == unquote && CDR(x) != NULL && cdr(CDR(x)) == NULL) {
+        if (level == 1) return eval_car(CDR(x), env);
+        level -= 1;
+    } else if (CAR(x) == quasiquote) {
+        level += 1;
+    }
+    return quasi_items(x, level, env);
+}
+
+// `x: x with its ,y parts replaced by the value of y and its ,@y parts by
+// the items of y
+static Value *quasiquote(Value *args, Env *env) {
+    return quasi(car(args), 1, env);
+}
+
 static Value *equal(Value *args, Env *env) {
     if (args == NULL) {
-        return copy_value(&vtrue);
+        return copy_value(TRUE);
     }
 
     Value *first = car(args);
@@ -154,12 +291,19 @@ static Value *equal(Value *args, Env *env) {
 
     while (args != NULL) {
         if (!values_equal(car(args), first)) {
-            return copy_value(&vfalse);
+            return copy_value(FALSE);
         }
         args = cdr(args);
     }
 
-    return copy_value(&vtrue);
+    return copy_value(TRUE);
+}
+
+// Evaluates the car of cell in tail position. Variables are still looked up
+// here, through the cell's lexical address.
+static Value *eval_car_tail(Value *cell, Env *env) {
+    if (TYPEOF(car(cell)) == TYPE_ATOM) return eval_car(cell, env);
+    return tail_call(car(cell));
 }
 
 static Value *cond(Value *args, Env *env) {
@@ -170,11 +314,9 @@ static Value *cond(Value *args, Env *env) {
             return create_exception("cond arguments must be 2-element lists");
         }
 
-        Value *b = eval(car(clause), env);
-        if (TYPEOF(b) == TYPE_BOOLEAN && b->value.boolean) {
-            Value *ret = eval(car(cdr(clause)), env);
-            delete_value(b);
-            return ret;
+        Value *b = eval_car(clause, env);
+        if (b == TRUE) {
+            return eval_car_tail(cdr(clause), env);
         }
 
         delete_value(b);
@@ -184,6 +326,125 @@ static Value *cond(Value *args, Env *env) {
     return NULL;
 }
 
+// Evaluates each form in turn, the value of the last is the result
+static Value *begin(Value *args, Env *env) {
+    if (args == NULL) return NULL;
+
+    for (; cdr(args) != NULL; args = cdr(args)) {
+        Value *ret = eval_car(args, env);
+        if (TYPEOF(ret) == TYPE_EXCEPTION) return ret;
+        delete_value(ret);
+    }
+
+    return eval_car_tail(args, env);
+}
+
+// (let ((name value) ...) body) evaluates the values in env, then body in a
+// new frame binding them to the names
+static Value *let(Value *args, Env *env) {
+    Value *bindings = car(args);
+    int count = 0;
+
+    if (cdr(args) == NULL) {
+        return create_exception("let must have a body");
+    } else if (!IS_LIST(bindings)) {
+        return create_exception("Bindings in let must be a list");
+    }
+
+    for (Value *b = bindings; b != NULL; b = cdr(b)) {
+        Value *binding = car(b);
+
+        if (TYPEOF(binding) != TYPE_LIST || TYPEOF(car(binding)) != TYPE_ATOM
+                || cdr(binding) == NULL) {
+            return create_exception("Bindings in let must be (name value) lists");
+        }
+        declare_local(car(binding));
+        count += 1;
+    }
+
+    Env *frame = create_frame(env, count);
+    EnvSlot *slot = frame->slots;
+
+    for (Value *b = bindings; b != NULL; b = cdr(b), slot++) {
+        Value *v = eval_car(cdr(car(b)), env);
+
+        if (TYPEOF(v) == TYPE_EXCEPTION) {
+            delete_env(frame);
+            return v;
+        }
+        slot->name = car(car(b));
+        slot->value = v;
+    }
+
+    Value *body = cdr(args);
+    if (TYPEOF(car(body)) == TYPE_ATOM) {
+        Value *ret = eval_car(body, frame);
+        delete_env(frame);
+        return ret;
+    }
+    return tail_call_in(car(body), frame);
+}
+
+// (if test then else), else may be left out
+static Value *bltn_if(Value *args, Env *env) {
+    if (cdr(args) == NULL) {
+        return create_exception("if must have a consequent");
+    }
+
+    Value *test = eval_car(args, env);
+    if (test == TRUE) {
+        return eval_car_tail(cdr(args), env);
+    } else if (TYPEOF(test) == TYPE_EXCEPTION) {
+        return test;
+    }
+
+    delete_value(test);
+    if (cdr(cdr(args)) == NULL) return NULL;
+    return eval_car_tail(cdr(cdr(args)), env);
+}
+
+// The first value that isn't #t, or the last
+static Value *bltn_and(Value *args, Env *env) {
+    if (args == NULL) return copy_value(TRUE);
+
+    for (; cdr(args) != NULL; args = cdr(args)) {
+        Value *v = eval_car(args, env);
+        if (v != TRUE) return v;
+    }
+
+    return eval_car_tail(args, env);
+}
+
+// #t if any value is, otherwise the last
+static Value *bltn_or(Value *args, Env *env) {
+    if (args == NULL) return copy_value(FALSE);
+
+    for (; cdr(args) != NULL; args = cdr(args)) {
+        Value *v = eval_car(args, env);
+        if (v == TRUE || TYPEOF(v) == TYPE_EXCEPTION) return v;
+        delete_value(v);
+    }
+
+    return eval_car_tail(args, env);
+}
+
+// (when test body ...) evaluates the body like begin if test is #t
+static Value *when(Value *args, Env *env) {
+    if (args == NULL) {
+        return create_exception("when must have a test");
+    }
+
+    Value *test = eval_car(args, env);
+    if (test == TRUE) {
+        return begin(cdr(args), env);
+    } else if (TYPEOF(test) == TYPE_EXCEPTION) {
+        return test;
+    }
+
+    delete_value(test);
+    return NULL;
+}
+
 #define SIMPLE_PRED(NAME, CHECK) \
 Value *NAME(Value *args, Env *e) { \
     if (CHECK) { \
@@ -201,6 +462,12 @@ SIMPLE_PRED(is_boolean, TYPEOF(car(args)) == TYPE_BOOLEAN);
 SIMPLE_PRED(is_exception, IS_EXCEPTION(car(args)));
 SIMPLE_PRED(is_function, IS_CALLABLE(car(args)))
 SIMPLE_PRED(is_string, TYPEOF(car(args)) == TYPE_STRING);
+SIMPLE_PRED(is_char, TYPEOF(car(args)) == TYPE_CHAR);
+SIMPLE_PRED(is_vector, TYPEOF(car(args)) == TYPE_VECTOR);
+SIMPLE_PRED(is_hashtable, TYPEOF(car(args)) == TYPE_HASHTABLE);
+SIMPLE_PRED(is_f64vector, TYPEOF(car(args)) == TYPE_F64VECTOR);
+SIMPLE_PRED(is_s64vector, TYPEOF(car(args)) == TYPE_S64VECTOR);
+SIMPLE_PRED(is_bytevector, TYPEOF(car(args)) == TYPE_BYTEVECTOR);
 
 Value *bltn_car(Value *args, Env *env) {
     return copy_value(car(car(args)));
@@ -223,10 +490,10 @@ Value *bltn_print(Value *args, Env *env) {
    while (args != NULL) {
        print(car(args));
        args = cdr(args);
-       if (args != NULL) printf(" ");
+       if (args != NULL) port_putc(current_output, ' ');
     }
 
-   puts("");
+   port_putc(current_output, '\n');
    return NULL;
 }
 
@@ -264,7 +531,7 @@ Value *OPER(Value *args, Env *env) { \
          return create_exception("Comparisons only works with numbers"); \
       } \
       \
-      if (prev != NULL && !(OPER ## _number(prev->value.number, curr->value.number))) { \
+      if (prev != NULL && !(OPER ## _number(number_of(prev), number_of(curr)))) { \
          return copy_value(FALSE); \
       } \
       \
@@ -285,12 +552,25 @@ Value *print_env(Value *args, Env *env) {
 
    while (env != NULL) {
       elm = env->first;
-      printf("frame %d:\n", frame);
+      port_printf(current_output, "frame %d:\n", frame);
+
+      for (int i = 0; i < env->size; i++) {
+         port_printf(current_output, "  %s = ", env->slots[i].name->value.atom);
+         print(env->slots[i].value);
+         port_putc(current_output, '\n');
+      }
+
+      for (unsigned i = 0; env->table && i < env->table->size; i++) {
+         if (env->table->slots[i] == NULL) continue;
+         port_printf(current_output, "  %s = ", env->table->slots[i]->name->value.atom);
+         print(env->table->slots[i]->value);
+         port_putc(current_output, '\n');
+      }
 
       while (elm != NULL) {
-         printf("  %s = ", elm->name);
+         port_printf(current_output, "  %s = ", elm->name->value.atom);
          print(elm->value);
-         puts("");
+         port_putc(current_output, '\n');
          elm = elm->next;
       }
 
@@ -307,8 +587,12 @@ Value *bltn_random(Value *args, Env *env) {
     if (TYPEOF(max) != TYPE_NUMBER) {
         return create_exception("random expects number");
     }
-    long long nmax = floor_number(max->value.number).v.ll;
-    return create_number(create_number_ll(rand() % nmax));
+    Number n = floor_number(number_of(max));
+    if (n.type != NUMBER_LLONG) {
+        free_number(n);
+        return create_exception("random expects a number that fits in a long long");
+    }
+    return create_number(create_number_ll(rand() % n.v.ll));
 }
 
 Value *bltn_include(Value *args, Env *env) {
@@ -322,7 +606,7 @@ Value *bltn_include(Value *args, Env *env) {
             return create_exception("include only accepts strings");
         }
 
-        ret = run_script(car(args)->value.string, env);
+        ret = run_script(string_cstr(car(args)), env);
         args = cdr(args);
     }
 
@@ -332,7 +616,7 @@ Value *bltn_include(Value *args, Env *env) {
 Value *bltn_raise(Value *args, Env *env) {
     Value *v = car(args);
     if (TYPEOF(v) == TYPE_STRING) {
-        return create_exception(v->value.string);
+        return create_exception("%s", string_cstr(v));
     } else if (IS_EXCEPTION(v)) {
         // Unbind exception
         // TODO copy?
@@ -352,10 +636,10 @@ Value *string_to_number(Value *args, Env *env) {
         if (TYPEOF(car(args)) != TYPE_STRING) {
             return create_exception("string->number expects a string as an argument");
         }
-        str = car(args)->value.string;
+        str = string_chars(car(args));
 
         // FIXME parse errors
-        *next = cons(create_number(parse_number(&str)), NULL);
+        *next = cons(create_number(parse_number(&str, str + string_len(car(args)))), NULL);
         next = &CDR(*next);
         args = cdr(args);
     }
@@ -369,8 +653,6 @@ Value *string_to_number(Value *args, Env *env) {
 }
 
 Value *number_to_string(Value *args, Env *env) {
-    char *str;
-    size_t len;
     Value *ls = NULL;
     Value **next = &ls;
 
@@ -379,18 +661,8 @@ Value *number_to_string(Value *args, Env *env) {
             return create_exception("number->string expects a number as an argument");
         }
 
-        if (car(args)->value.number.type == NUMBER_LLONG) {
-            len = snprintf(NULL, 0, "%lld\n", car(args)->value.number.v.ll);
-            str = malloc(len + 1);
-            sprintf(str, "%lld", car(args)->value.number.v.ll);
-        } else {
-            len = snprintf(NULL, 0, "%g\n", car(args)->value.number.v.d);
-            str = malloc(len + 1);
-            sprintf(str, "%g", car(args)->value.number.v.d);
-        }
-
         // FIXME parse errors
-        *next = cons(create_string_alloced(str), NULL);
+        *next = cons(create_string_alloced(format_number(number_of(car(args)))), NULL);
         next = &CDR(*next);
         args = cdr(args);
     }
@@ -403,104 +675,873 @@ Value *number_to_string(Value *args, Env *env) {
     return ls;
 }
 
-Value *concat(Value *args, Env *env) {
-    size_t len = 0, sz = 16, src_len;
-    char *s = malloc(sz + 1);
+Value *char_to_integer(Value *args, Env *env) {
+    if (TYPEOF(car(args)) != TYPE_CHAR) {
+        return create_exception("char->integer expects a character");
+    }
+    return FIXNUM(CHAR_VALUE(car(args)));
+}
 
-    while (args != NULL) {
-        if (TYPEOF(car(args)) != TYPE_STRING) {
-            free(s);
+Value *integer_to_char(Value *args, Env *env) {
+    if (!IS_FIXNUM(car(args)) || FIXNUM_VALUE(car(args)) < 0 || FIXNUM_VALUE(car(args)) > 255) {
+        return create_exception("integer->char expects an integer from 0 to 255");
+    }
+    return CHAR(FIXNUM_VALUE(car(args)));
+}
+
+Value *concat(Value *args, Env *env) {
+    for (Value *p = args; p != NULL; p = cdr(p)) {
+        if (TYPEOF(car(p)) != TYPE_STRING) {
             return create_exception("concat expects strings");
         }
+    }
+    return concat_strings(args);
+}
 
-        src_len = strlen(car(args)->value.string);
-        len += src_len;
-        if (len > sz) {
-            if (cdr(args) == NULL) sz = len;
-            else while (len > sz)  sz <<= 1;
-            s = realloc(s, sz + 1);
-        }
-        strcpy(s + len - src_len, car(args)->value.string);
+Value *string_length(Value *args, Env *env) {
+    if (TYPEOF(car(args)) != TYPE_STRING) {
+        return create_exception("string-length expects a string");
+    }
+    return FIXNUM(string_len(car(args)));
+}
 
-        args = cdr(args);
+Value *string_ref(Value *args, Env *env) {
+    Value *s = car(args), *k = car(cdr(args));
+
+    if (TYPEOF(s) != TYPE_STRING || !IS_FIXNUM(k)) {
+        return create_exception("string-ref expects a string and an index");
+    }
+    if (FIXNUM_VALUE(k) < 0 || (size_t)FIXNUM_VALUE(k) >= string_len(s)) {
+        return create_exception("string-ref index %ld out of range", (long)FIXNUM_VALUE(k));
     }
+    return CHAR(string_chars(s)[FIXNUM_VALUE(k)]);
+}
+
+// (substring s start [end]) shares the bytes of s
+Value *substring(Value *args, Env *env) {
+    Value *s = car(args), *start = car(cdr(args)), *end = car(cdr(cdr(args)));
 
-    return create_string_alloced(s);
+    if (TYPEOF(s) != TYPE_STRING || !IS_FIXNUM(start) || (end != NULL && !IS_FIXNUM(end))) {
+        return create_exception("substring expects a string and indexes");
+    }
+
+    intptr_t from = FIXNUM_VALUE(start);
+    intptr_t to = end == NULL ? (intptr_t)string_len(s) : FIXNUM_VALUE(end);
+    if (from < 0 || from > to || (size_t)to > string_len(s)) {
+        return create_exception("substring indexes %ld and %ld out of range", (long)from, (long)to);
+    }
+    return create_substring(s, from, to - from);
 }
 
+// The contents of a file as a bytevector, mapped rather than copied where
+// the system allows it
 Value *read_file(Value *args, Env *env) {
-    FILE *f;
-    char *s;
-    size_t sz;
+    size_t size;
 
-    if (car(args) == NULL || TYPEOF(car(args)) != TYPE_STRING || cdr(args) != NULL) {
+    if (TYPEOF(car(args)) != TYPE_STRING || cdr(args) != NULL) {
         return create_exception("read-file expects a single string argument");
     }
 
-    f = fopen(car(args)->value.string, "r");
+    const char *path = string_cstr(car(args));
+    const void *data = map_file(path, &size);
+    if (data != NULL) return map_bytevector(data, size);
+
+    // Empty files aren't mapped
+    FILE *f = fopen(path, "rb");
     if (f == NULL) {
-        return create_exception("Cannot open file '%s'", car(args)->value.string);
+        return create_exception("Cannot open file '%s'", path);
     }
+    fclose(f);
+    return create_bytevector(0);
+}
 
-    fseek(f, 0, SEEK_END);
-    sz = ftell(f);
-    fseek(f, 0, SEEK_SET);
+Value *bytevector(Value *args, Env *env) {
+    size_t len = 0;
+    for (Value *p = args; p != NULL; p = cdr(p)) {
+        if (!IS_FIXNUM(car(p)) || FIXNUM_VALUE(car(p)) < 0 || FIXNUM_VALUE(car(p)) > 255) {
+            return create_exception("bytevector expects integers from 0 to 255");
+        }
+        len++;
+    }
 
-    fclose(f);
-    return create_number(create_number_ll(sz));
+    Value *bv = create_bytevector(len);
+    unsigned char *data = bytevector_data(bv);
+    for (Value *p = args; p != NULL; p = cdr(p)) {
+        *data++ = FIXNUM_VALUE(car(p));
+    }
+    return bv;
+}
 
-    // TODO binary rather than string
-    s = malloc(sz + 1);
-    fread(s, 1, sz, f);
-    fclose(f);
+Value *bytevector_length(Value *args, Env *env) {
+    if (TYPEOF(car(args)) != TYPE_BYTEVECTOR) {
+        return create_exception("bytevector-length expects a bytevector");
+    }
+    return FIXNUM(bytevector_len(car(args)));
+}
+
+Value *bytevector_u8_ref(Value *args, Env *env) {
+    Value *bv = car(args), *k = car(cdr(args));
 
-    return create_string_alloced(s);
+    if (TYPEOF(bv) != TYPE_BYTEVECTOR || !IS_FIXNUM(k)) {
+        return create_exception("bytevector-u8-ref expects a bytevector and an index");
+    }
+    if (FIXNUM_VALUE(k) < 0 || (size_t)FIXNUM_VALUE(k) >= bytevector_len(bv)) {
+        return create_exception("bytevector-u8-ref index %ld out of range", (long)FIXNUM_VALUE(k));
+    }
+    return FIXNUM(bytevector_data(bv)[FIXNUM_VALUE(k)]);
 }
 
-Env *create_global_env(void) {
-    Env *env = create_env(NULL);
+// Checks that start and end, either of which may be left out, are indexes
+// into bytevector bv for name and stores them in *from and *to
+static Value *byte_range(Value *bv, Value *start, Value *end, const char *name,
+        size_t *from, size_t *to) {
+    if (TYPEOF(bv) != TYPE_BYTEVECTOR || (start != NULL && !IS_FIXNUM(start))
+            || (end != NULL && !IS_FIXNUM(end))) {
+        return create_exception("%s expects a bytevector and indexes", name);
+    }
 
-    srand(time(NULL));
+    intptr_t s = start == NULL ? 0 : FIXNUM_VALUE(start);
+    intptr_t e = end == NULL ? (intptr_t)bytevector_len(bv) : FIXNUM_VALUE(end);
+    if (s < 0 || s > e || (size_t)e > bytevector_len(bv)) {
+        return create_exception("%s indexes %ld and %ld out of range", name, (long)s, (long)e);
+    }
+
+    *from = s;
+    *to = e;
+    return NULL;
+}
+
+// (bytevector-slice bv start [end]) shares the bytes of bv
+Value *bytevector_slice(Value *args, Env *env) {
+    size_t from, to;
+    Value *error = byte_range(car(args), car(cdr(args)), car(cdr(cdr(args))),
+            "bytevector-slice", &from, &to);
+    if (error) return error;
+
+    return create_byteslice(car(args), from, to - from);
+}
+
+// (utf8->string bv [start [end]]) copies the bytes to a string
+Value *utf8_to_string(Value *args, Env *env) {
+    size_t from, to;
+    Value *error = byte_range(car(args), car(cdr(args)), car(cdr(cdr(args))),
+            "utf8->string", &from, &to);
+    if (error) return error;
+
+    return create_string_len((const char *)bytevector_data(car(args)) + from, to - from);
+}
+
+Value *vector(Value *args, Env *env) {
+    return list_to_vector(args);
+}
+
+// (make-vector k [fill]), fill defaults to 0
+Value *make_vector(Value *args, Env *env) {
+    Value *k = car(args);
+    if (!IS_FIXNUM(k) || FIXNUM_VALUE(k) < 0) {
+        return create_exception("make-vector expects a non-negative length");
+    }
+
+    Value *fill = cdr(args) != NULL ? car(cdr(args)) : FIXNUM(0);
+    return create_vector(FIXNUM_VALUE(k), fill);
+}
+
+Value *vector_length(Value *args, Env *env) {
+    if (TYPEOF(car(args)) != TYPE_VECTOR) {
+        return create_exception("vector-length expects a vector");
+    }
+    return FIXNUM(car(args)->value.vector.len);
+}
+
+// The item of the vector in args at the index after it, NULL if there is none
+static Value **vector_item(Value *args) {
+    Value *v = car(args), *k = car(cdr(args));
+
+    if (TYPEOF(v) != TYPE_VECTOR || !IS_FIXNUM(k)) return NULL;
+    if (FIXNUM_VALUE(k) < 0 || (size_t)FIXNUM_VALUE(k) >= v->value.vector.len) return NULL;
+    return &v->value.vector.items[FIXNUM_VALUE(k)];
+}
+
+Value *vector_ref(Value *args, Env *env) {
+    Value **item = vector_item(args);
+    if (item == NULL) {
+        return create_exception("vector-ref expects a vector and an index in it");
+    }
+    return copy_value(*item);
+}
+
+Value *vector_set(Value *args, Env *env) {
+    Value **item = vector_item(args);
+    if (item == NULL) {
+        return create_exception("vector-set! expects a vector and an index in it");
+    }
+
+    Value *old = *item;
+    *item = copy_value(car(cdr(cdr(args))));
+    delete_value(old);
+    return NULL;
+}
+
+Value *vector_to_list(Value *args, Env *env) {
+    Value *v = car(args), *ls = NULL;
+    if (TYPEOF(v) != TYPE_VECTOR) {
+        return create_exception("vector->list expects a vector");
+    }
+
+    for (size_t i = v->value.vector.len; i > 0; i--) {
+        ls = cons(copy_value(v->value.vector.items[i - 1]), ls);
+    }
+    return ls;
+}
+
+Value *bltn_list_to_vector(Value *args, Env *env) {
+    if (!IS_LIST(car(args))) {
+        return create_exception("list->vector expects a list");
+    }
+    return list_to_vector(car(args));
+}
+
+// (make-hash-table ['eq | 'equal | 'string]), keys are compared with equal
+// semantics by default
+Value *make_hash_table(Value *args, Env *env) {
+    if (args == NULL) return create_hashtable(HASH_EQUAL);
+
+    Value *kind = car(args);
+
+    if (TYPEOF(kind) == TYPE_ATOM) {
+        if (!strcmp(kind->value.atom, "eq")) return create_hashtable(HASH_EQ);
+        if (!strcmp(kind->value.atom, "equal")) return create_hashtable(HASH_EQUAL);
+        if (!strcmp(kind->value.atom, "string")) return create_hashtable(HASH_STRING);
+    }
+    return create_exception("make-hash-table expects 'eq, 'equal or 'string");
+}
+
+// The table in args if the key after it can go in it, NULL if not
+static struct HashTable *hash_args(Value *args) {
+    Value *v = car(args);
+    if (TYPEOF(v) != TYPE_HASHTABLE) return NULL;
+
+    struct HashTable *table = v->value.hashtable;
+    if (table->kind == HASH_STRING && TYPEOF(car(cdr(args))) != TYPE_STRING) return NULL;
+    return table;
+}
+
+// (hash-ref table key [default]), default is #f
+Value *hash_ref(Value *args, Env *env) {
+    struct HashTable *table = hash_args(args);
+    if (table == NULL) {
+        return create_exception("hash-ref expects a hash table and a key for it");
+    }
+
+    Value **value = hashtable_find(table, car(cdr(args)));
+    if (value != NULL) return copy_value(*value);
+
+    Value *rest = cdr(cdr(args));
+    return rest != NULL ? copy_value(car(rest)) : FALSE;
+}
+
+Value *hash_set(Value *args, Env *env) {
+    struct HashTable *table = hash_args(args);
+    if (table == NULL) {
+        return create_exception("hash-set! expects a hash table and a key for it");
+    }
+
+    hashtable_set(table, copy_value(car(cdr(args))), copy_value(car(cdr(cdr(args)))));
+    return NULL;
+}
+
+// Returns whether the key was there
+Value *hash_delete(Value *args, Env *env) {
+    struct HashTable *table = hash_args(args);
+    if (table == NULL) {
+        return create_exception("hash-delete! expects a hash table and a key for it");
+    }
+    return hashtable_delete(table, car(cdr(args))) ? TRUE : FALSE;
+}
+
+Value *hash_count(Value *args, Env *env) {
+    if (TYPEOF(car(args)) != TYPE_HASHTABLE) {
+        return create_exception("hash-count expects a hash table");
+    }
+    return FIXNUM(car(args)->value.hashtable->count);
+}
 
-    add_to_env(env, "+", create_builtin(bltn_add));
-    add_to_env(env, "-", create_builtin(bltn_sub));
-    add_to_env(env, "*", create_builtin(bltn_mul));
-    add_to_env(env, "/", create_builtin(bltn_div));
-    add_to_env(env, "remainder", create_builtin(bltn_rem));
-    add_to_env(env, "quote", create_builtin_sf(quote));
-    add_to_env(env, "lambda", create_builtin_sf(lambda));
-    add_to_env(env, "macro", create_builtin_sf(macro));
-    add_to_env(env, "define", create_builtin_sf(define));
-    add_to_env(env, "set!", create_builtin_sf(set));
-    add_to_env(env, "#t", copy_value(&vtrue));
-    add_to_env(env, "#f", copy_value(&vfalse));
-    add_to_env(env, "cond", create_builtin_sf(cond));
-    add_to_env(env, "=", create_builtin(equal));
-    add_to_env(env, "eval", create_builtin(eval_block));
-    add_to_env(env, "null?", create_builtin(is_null));
-    add_to_env(env, "list?", create_builtin(is_list));
-    add_to_env(env, "number?", create_builtin(is_number));
-    add_to_env(env, "boolean?", create_builtin(is_boolean));
-    add_to_env(env, "exception?", create_builtin(is_exception));
-    add_to_env(env, "function?", create_builtin(is_function));
-    add_to_env(env, "string?", create_builtin(is_string));
-    add_to_env(env, "car", create_builtin(bltn_car));
-    add_to_env(env, "cdr", create_builtin(bltn_cdr));
-    add_to_env(env, "cons", create_builtin(bltn_cons));
-    add_to_env(env, "print", create_builtin(bltn_print));
-    add_to_env(env, "try", create_builtin_sf(trycatch));
-    add_to_env(env, "<", create_builtin(lt));
-    add_to_env(env, ">", create_builtin(gt));
-    add_to_env(env, "<=", create_builtin(lte));
-    add_to_env(env, ">=", create_builtin(gte));
-    add_to_env(env, "print-env", create_builtin(print_env));
-    add_to_env(env, "random", create_builtin(bltn_random));
-    add_to_env(env, "include", create_builtin(bltn_include));
-    add_to_env(env, "raise", create_builtin(bltn_raise));
-    add_to_env(env, "string->number", create_builtin(string_to_number));
-    add_to_env(env, "number->string", create_builtin(number_to_string));
-    add_to_env(env, "concat", create_builtin(concat));
-    add_to_env(env, "read-file", create_builtin(read_file));
-
-    return env;
+static void collect_entry(HashEntry *e, void *data) {
+    Value **ls = data;
+    *ls = cons(cons(copy_value(e->key), cons(copy_value(e->value), NULL)), *ls);
+}
+
+// (hash-for-each table proc) calls (proc key value) on every entry. They are
+// collected first, so proc can change the table.
+Value *hash_for_each(Value *args, Env *env) {
+    Value *apply_func(Value *func, Value *args, Env *env);
+    Value *v = car(args), *proc = car(cdr(args));
+
+    if (TYPEOF(v) != TYPE_HASHTABLE || !IS_CALLABLE(proc)) {
+        return create_exception("hash-for-each expects a hash table and a function");
+    }
+
+    Value *entries = NULL, *ret = NULL;
+    hashtable_each(v->value.hashtable, collect_entry, &entries);
+
+    for (Value *it = entries; it != NULL; it = CDR(it)) {
+        ret = apply_func(proc, CAR(it), env);
+
+        if (TYPEOF(ret) == TYPE_EXCEPTION) break;
+        delete_value(ret);
+        ret = NULL;
+    }
+
+    delete_value(entries);
+    return ret;
+}
+
+// f64vectors and s64vectors. Each builtin is written once for both, with
+// the type of vector it makes or expects as the first argument.
+
+// Whether x can be an item of a vector of type
+static int numvector_fits(enum Type type, Value *x) {
+    if (TYPEOF(x) != TYPE_NUMBER) return 0;
+    return type == TYPE_F64VECTOR || number_of(x).type == NUMBER_LLONG;
+}
+
+static void numvector_put(Value *v, size_t i, Value *x) {
+    if (v->type == TYPE_F64VECTOR) {
+        v->value.numvector.f64[i] = number_to_double(number_of(x));
+    } else {
+        v->value.numvector.s64[i] = number_of(x).v.ll;
+    }
+}
+
+static Value *numvector_get(Value *v, size_t i) {
+    if (v->type == TYPE_F64VECTOR) {
+        return create_number(create_number_d(v->value.numvector.f64[i]));
+    }
+    return create_number(create_number_ll(v->value.numvector.s64[i]));
+}
+
+static Value *list_to_numvector(enum Type type, Value *ls) {
+    size_t len = 0;
+    for (Value *it = ls; it != NULL; it = cdr(it)) {
+        if (!numvector_fits(type, car(it))) return NULL;
+        len++;
+    }
+
+    Value *v = create_numvector(type, len);
+    for (size_t i = 0; i < len; i++, ls = cdr(ls)) numvector_put(v, i, car(ls));
+    return v;
+}
+
+static Value *numvector(enum Type type, Value *args) {
+    Value *v = list_to_numvector(type, args);
+    if (v == NULL) {
+        return create_exception("%s expects %s", type_names[type],
+                type == TYPE_F64VECTOR ? "numbers" : "integers");
+    }
+    return v;
+}
+
+static Value *make_numvector(enum Type type, Value *args) {
+    Value *k = car(args);
+    Value *fill = cdr(args) != NULL ? car(cdr(args)) : FIXNUM(0);
+
+    if (!IS_FIXNUM(k) || FIXNUM_VALUE(k) < 0 || !numvector_fits(type, fill)) {
+        return create_exception("make-%s expects a non-negative length and a fill %s", type_names[type],
+                type == TYPE_F64VECTOR ? "number" : "integer");
+    }
+
+    Value *v = create_numvector(type, FIXNUM_VALUE(k));
+    for (size_t i = 0; i < v->value.numvector.len; i++) numvector_put(v, i, fill);
+    return v;
+}
+
+static Value *numvector_length(enum Type type, Value *args) {
+    if (TYPEOF(car(args)) != type) {
+        return create_exception("%s-length expects a %s", type_names[type], type_names[type]);
+    }
+    return FIXNUM(car(args)->value.numvector.len);
+}
+
+// The index after the vector in args, -1 if it isn't one
+static intptr_t numvector_index(enum Type type, Value *args) {
+    Value *v = car(args), *k = car(cdr(args));
+
+    if (TYPEOF(v) != type || !IS_FIXNUM(k)) return -1;
+    if (FIXNUM_VALUE(k) < 0 || (size_t)FIXNUM_VALUE(k) >= v->value.numvector.len) return -1;
+    return FIXNUM_VALUE(k);
+}
+
+static Value *numvector_ref(enum Type type, Value *args) {
+    intptr_t i = numvector_index(type, args);
+    if (i < 0) {
+        return create_exception("%s-ref expects a %s and an index in it", type_names[type], type_names[type]);
+    }
+    return numvector_get(car(args), i);
+}
+
+static Value *numvector_set(enum Type type, Value *args) {
+    intptr_t i = numvector_index(type, args);
+    Value *x = car(cdr(cdr(args)));
+
+    if (i < 0 || !numvector_fits(type, x)) {
+        return create_exception("%s-set! expects a %s, an index in it and an item for it",
+                type_names[type], type_names[type]);
+    }
+    numvector_put(car(args), i, x);
+    return NULL;
+}
+
+static Value *numvector_to_list(enum Type type, Value *args) {
+    Value *v = car(args), *ls = NULL;
+    if (TYPEOF(v) != type) {
+        return create_exception("%s->list expects a %s", type_names[type], type_names[type]);
+    }
+
+    for (size_t i = v->value.numvector.len; i > 0; i--) ls = cons(numvector_get(v, i - 1), ls);
+    return ls;
+}
+
+static Value *list_to_numvector_builtin(enum Type type, Value *args) {
+    Value *v = IS_LIST(car(args)) ? list_to_numvector(type, car(args)) : NULL;
+    if (v == NULL) {
+        return create_exception("list->%s expects a list of %s", type_names[type],
+                type == TYPE_F64VECTOR ? "numbers" : "integers");
+    }
+    return v;
+}
+
+// The two vectors of the same length in args, NULL if they aren't
+static struct NumVector *numvector_pair(enum Type type, Value *args, struct NumVector **b) {
+    Value *x = car(args), *y = car(cdr(args));
+
+    if (TYPEOF(x) != type || TYPEOF(y) != type) return NULL;
+    if (x->value.numvector.len != y->value.numvector.len) return NULL;
+    *b = &y->value.numvector;
+    return &x->value.numvector;
+}
+
+static Value *numvector_add(enum Type type, Value *args, int mul) {
+    struct NumVector *a, *b;
+    const char *op = mul ? "mul" : "add";
+
+    if ((a = numvector_pair(type, args, &b)) == NULL) {
+        return create_exception("%s-%s expects two %ss of the same length", type_names[type], op, type_names[type]);
+    }
+
+    Value *r = create_numvector(type, a->len);
+    if (type == TYPE_F64VECTOR) {
+        (mul ? f64_mul : f64_add)(r->value.numvector.f64, a->f64, b->f64, a->len);
+    } else if (!(mul ? s64_mul : s64_add)(r->value.numvector.s64, a->s64, b->s64, a->len)) {
+        delete_value(r);
+        return create_exception("s64vector-%s overflows", op);
+    }
+    return r;
+}
+
+static Value *numvector_scale(enum Type type, Value *args) {
+    Value *v = car(args), *k = car(cdr(args));
+
+    if (TYPEOF(v) != type || !numvector_fits(type, k)) {
+        return create_exception("%s-scale expects a %s and a factor for its items", type_names[type], type_names[type]);
+    }
+
+    struct NumVector *a = &v->value.numvector;
+    Value *r = create_numvector(type, a->len);
+    if (type == TYPE_F64VECTOR) {
+        f64_scale(r->value.numvector.f64, a->f64, number_to_double(number_of(k)), a->len);
+    } else if (!s64_scale(r->value.numvector.s64, a->s64, number_of(k).v.ll, a->len)) {
+        delete_value(r);
+        return create_exception("s64vector-scale overflows");
+    }
+    return r;
+}
+
+// The sum of a, or the dot product of a and b, of s64vector items that
+// overflowed the fast path
+static Value *exact_sum(struct NumVector *a, struct NumVector *b) {
+    Number total = create_number_ll(0), next, product;
+
+    for (size_t i = 0; i < a->len; i++) {
+        if (b != NULL) {
+            product = mul_number(create_number_ll(a->s64[i]), create_number_ll(b->s64[i]));
+            next = add_number(total, product);
+            free_number(product);
+        } else {
+            next = add_number(total, create_number_ll(a->s64[i]));
+        }
+        free_number(total);
+        total = next;
+    }
+    return create_number(total);
+}
+
+static Value *numvector_sum(enum Type type, Value *args) {
+    Value *v = car(args);
+    int64_t sum;
+
+    if (TYPEOF(v) != type) {
+        return create_exception("%s-sum expects a %s", type_names[type], type_names[type]);
+    }
+
+    struct NumVector *a = &v->value.numvector;
+    if (type == TYPE_F64VECTOR) return create_number(create_number_d(f64_sum(a->f64, a->len)));
+    if (s64_sum(a->s64, a->len, &sum)) return create_number(create_number_ll(sum));
+    return exact_sum(a, NULL);
+}
+
+static Value *numvector_dot(enum Type type, Value *args) {
+    struct NumVector *a, *b;
+    int64_t dot;
+
+    if ((a = numvector_pair(type, args, &b)) == NULL) {
+        return create_exception("%s-dot expects two %ss of the same length", type_names[type], type_names[type]);
+    }
+
+    if (type == TYPE_F64VECTOR) return create_number(create_number_d(f64_dot(a->f64, b->f64, a->len)));
+    if (s64_dot(a->s64, b->s64, a->len, &dot)) return create_number(create_number_ll(dot));
+    return exact_sum(a, b);
+}
+
+static Value *numvector_extreme(enum Type type, Value *args, int max) {
+    Value *v = car(args);
+    const char *op = max ? "max" : "min";
+
+    if (TYPEOF(v) != type || v->value.numvector.len == 0) {
+        return create_exception("%s-%s expects a non-empty %s", type_names[type], op, type_names[type]);
+    }
+
+    struct NumVector *a = &v->value.numvector;
+    if (type == TYPE_F64VECTOR) {
+        return create_number(create_number_d((max ? f64_max : f64_min)(a->f64, a->len)));
+    }
+    return create_number(create_number_ll((max ? s64_max : s64_min)(a->s64, a->len)));
+}
+
+#define NUMVECTOR_BUILTINS(KIND, TYPE) \
+Value *KIND ## vector(Value *args, Env *env) { return numvector(TYPE, args); } \
+Value *make_ ## KIND ## vector(Value *args, Env *env) { return make_numvector(TYPE, args); } \
+Value *KIND ## vector_length(Value *args, Env *env) { return numvector_length(TYPE, args); } \
+Value *KIND ## vector_ref(Value *args, Env *env) { return numvector_ref(TYPE, args); } \
+Value *KIND ## vector_set(Value *args, Env *env) { return numvector_set(TYPE, args); } \
+Value *KIND ## vector_to_list(Value *args, Env *env) { return numvector_to_list(TYPE, args); } \
+Value *list_to_ ## KIND ## vector(Value *args, Env *env) { return list_to_numvector_builtin(TYPE, args); } \
+Value *KIND ## vector_add(Value *args, Env *env) { return numvector_add(TYPE, args, 0); } \
+Value *KIND ## vector_mul(Value *args, Env *env) { return numvector_add(TYPE, args, 1); } \
+Value *KIND ## vector_scale(Value *args, Env *env) { return numvector_scale(TYPE, args); } \
+Value *KIND ## vector_sum(Value *args, Env *env) { return numvector_sum(TYPE, args); } \
+Value *KIND ## vector_dot(Value *args, Env *env) { return numvector_dot(TYPE, args); } \
+Value *KIND ## vector_min(Value *args, Env *env) { return numvector_extreme(TYPE, args, 0); } \
+Value *KIND ## vector_max(Value *args, Env *env) { return numvector_extreme(TYPE, args, 1); }
+
+NUMVECTOR_BUILTINS(f64, TYPE_F64VECTOR)
+NUMVECTOR_BUILTINS(s64, TYPE_S64VECTOR)
+
+static Value *port_value(Port *port) {
+    Value *v = create_value(TYPE_PORT);
+    v->value.port = port;
+    return v;
+}
+
+// The port in arg, the optional last argument of name, or current_output if
+// it was left out. Sets *error and returns NULL if it isn't an open port.
+static Port *output_port(Value *arg, const char *name, Value **error) {
+    if (arg == NULL) return current_output;
+
+    if (TYPEOF(arg) != TYPE_PORT || arg->value.port->flags & PORT_INPUT) {
+        *error = create_exception("%s expects an output port", name);
+        return NULL;
+    }
+    if (arg->value.port->flags & PORT_CLOSED) {
+        *error = create_exception("%s: the port is closed", name);
+        return NULL;
+    }
+    return arg->value.port;
+}
+
+// As output_port(), for input ports and stdin
+static Port *input_port(Value *arg, const char *name, Value **error) {
+    if (arg == NULL) return &stdin_port;
+
+    if (TYPEOF(arg) != TYPE_PORT || !(arg->value.port->flags & PORT_INPUT)) {
+        *error = create_exception("%s expects an input port", name);
+        return NULL;
+    }
+    if (arg->value.port->flags & PORT_CLOSED) {
+        *error = create_exception("%s: the port is closed", name);
+        return NULL;
+    }
+    return arg->value.port;
+}
+
+SIMPLE_PRED(is_output_port, TYPEOF(car(args)) == TYPE_PORT && !(car(args)->value.port->flags & PORT_INPUT));
+SIMPLE_PRED(is_input_port, TYPEOF(car(args)) == TYPE_PORT && car(args)->value.port->flags & PORT_INPUT);
+SIMPLE_PRED(is_eof_object, car(args) == &eof_object);
+
+Value *open_output_file_builtin(Value *args, Env *env) {
+    if (TYPEOF(car(args)) != TYPE_STRING) {
+        return create_exception("open-output-file expects a file name");
+    }
+
+    Port *port = open_output_file(string_cstr(car(args)));
+    if (port == NULL) {
+        return create_exception("Cannot open file '%s'", string_cstr(car(args)));
+    }
+    return port_value(port);
+}
+
+Value *open_output_string_builtin(Value *args, Env *env) {
+    return port_value(open_output_string());
+}
+
+Value *get_output_string(Value *args, Env *env) {
+    if (TYPEOF(car(args)) != TYPE_PORT
+            || (car(args)->value.port->flags & (PORT_STRING | PORT_INPUT)) != PORT_STRING) {
+        return create_exception("get-output-string expects a string output port");
+    }
+
+    Port *port = car(args)->value.port;
+    return create_string_len(port->buf, port->len);
+}
+
+Value *close_port_builtin(Value *args, Env *env) {
+    if (TYPEOF(car(args)) != TYPE_PORT) {
+        return create_exception("close-port expects a port");
+    }
+    if (close_port(car(args)->value.port)) {
+        return create_exception("Error writing to a port");
+    }
+    return NULL;
+}
+
+Value *flush_output_port(Value *args, Env *env) {
+    Value *error = NULL;
+    Port *port = output_port(car(args), "flush-output-port", &error);
+    if (port == NULL) return error;
+
+    if (flush_port(port)) {
+        return create_exception("Error writing to a port");
+    }
+    return NULL;
+}
+
+// (write obj [port]) and (display obj [port])
+static Value *write_to_port(Value *args, int display) {
+    Value *error = NULL;
+    Port *port = output_port(car(cdr(args)), display ? "display" : "write", &error);
+    if (port == NULL) return error;
+
+    write_value(port, car(args), display);
+    return NULL;
+}
+
+Value *bltn_write(Value *args, Env *env) {
+    return write_to_port(args, 0);
+}
+
+Value *bltn_display(Value *args, Env *env) {
+    return write_to_port(args, 1);
+}
+
+Value *bltn_newline(Value *args, Env *env) {
+    Value *error = NULL;
+    Port *port = output_port(car(args), "newline", &error);
+    if (port == NULL) return error;
+
+    port_putc(port, '\n');
+    return NULL;
+}
+
+// (write-bytevector bv [port [start [end]]])
+Value *write_bytevector(Value *args, Env *env) {
+    size_t from, to;
+    Value *error = NULL;
+    Port *port = output_port(car(cdr(args)), "write-bytevector", &error);
+    if (port == NULL) return error;
+
+    Value *rest = cdr(cdr(args));
+    error = byte_range(car(args), car(rest), car(cdr(rest)), "write-bytevector", &from, &to);
+    if (error) return error;
+
+    port_write(port, (const char *)bytevector_data(car(args)) + from, to - from);
+    return NULL;
+}
+
+Value *open_input_file_builtin(Value *args, Env *env) {
+    if (TYPEOF(car(args)) != TYPE_STRING) {
+        return create_exception("open-input-file expects a file name");
+    }
+
+    Port *port = open_input_file(string_cstr(car(args)));
+    if (port == NULL) {
+        return create_exception("Cannot open file '%s'", string_cstr(car(args)));
+    }
+    return port_value(port);
+}
+
+Value *open_input_string_builtin(Value *args, Env *env) {
+    if (TYPEOF(car(args)) != TYPE_STRING) {
+        return create_exception("open-input-string expects a string");
+    }
+    return port_value(open_input_string(string_chars(car(args)), string_len(car(args))));
+}
+
+Value *read_line(Value *args, Env *env) {
+    size_t len;
+    Value *error = NULL;
+    Port *port = input_port(car(args), "read-line", &error);
+    if (port == NULL) return error;
+
+    const char *line = port_read_line(port, &len);
+    if (line == NULL) return copy_value(&eof_object);
+    return create_string_len(line, len);
+}
+
+Value *read_char(Value *args, Env *env) {
+    Value *error = NULL;
+    Port *port = input_port(car(args), "read-char", &error);
+    if (port == NULL) return error;
+
+    int ch = port_getc(port);
+    return ch < 0 ? copy_value(&eof_object) : CHAR(ch);
+}
+
+Value *peek_char(Value *args, Env *env) {
+    Value *error = NULL;
+    Port *port = input_port(car(args), "peek-char", &error);
+    if (port == NULL) return error;
+
+    int ch = port_peekc(port);
+    return ch < 0 ? copy_value(&eof_object) : CHAR(ch);
+}
+
+Value *bltn_read(Value *args, Env *env) {
+    Value *error = NULL;
+    Port *port = input_port(car(args), "read", &error);
+    if (port == NULL) return error;
+
+    return read_datum(port);
+}
+
+Value *eof_object_builtin(Value *args, Env *env) {
+    return copy_value(&eof_object);
+}
+
+// (for-each-line proc port) calls proc with each line of port, or of the
+// file named instead. The string passed is reused for the next line unless
+// proc kept it.
+Value *for_each_line(Value *args, Env *env) {
+    Value *apply_func(Value *func, Value *args, Env *env);
+    Value *proc = car(args), *source = car(cdr(args));
+    Value *error = NULL;
+    Port *port;
+
+    if (!IS_CALLABLE(proc)) {
+        return create_exception("for-each-line expects a function");
+    }
+
+    if (TYPEOF(source) == TYPE_STRING) {
+        port = open_input_file(string_cstr(source));
+        if (port == NULL) {
+            return create_exception("Cannot open file '%s'", string_cstr(source));
+        }
+    } else {
+        port = input_port(source, "for-each-line", &error);
+        if (port == NULL) return error;
+    }
+
+    Value *call = NULL; // (line), reused while proc keeps neither it nor line
+    const char *line;
+    size_t len;
+
+    while ((line = port_read_line(port, &len)) != NULL) {
+        if (call != NULL && call->refs == 1) {
+            CAR(call) = reuse_string(CAR(call), line, len);
+        } else {
+            delete_value(call);
+            call = cons(create_string_len(line, len), NULL);
+        }
+
+        Value *res = apply_func(proc, call, env);
+        if (TYPEOF(res) == TYPE_EXCEPTION) {
+            error = res;
+            break;
+        }
+        delete_value(res);
+    }
+
+    delete_value(call);
+    if (TYPEOF(source) == TYPE_STRING) free_port(port);
+    return error;
+}
+
+// Calls thunk with current_output going to a string, which it returns
+Value *with_output_to_string(Value *args, Env *env) {
+    Value *apply_func(Value *func, Value *args, Env *env);
+
+    if (!IS_CALLABLE(car(args))) {
+        return create_exception("with-output-to-string expects a function");
+    }
+
+    Port *saved = current_output;
+    Port *port = open_output_string();
+
+    current_output = port;
+    Value *res = apply_func(car(args), NULL, env);
+    current_output = saved;
+
+    if (TYPEOF(res) == TYPE_EXCEPTION) {
+        free_port(port);
+        return res;
+    }
+    delete_value(res);
+
+    Value *str = create_string_len(port->buf, port->len);
+    free_port(port);
+    return str;
+}
+
+// Collects unreachable cycles now, returns how many objects were freed
+Value *bltn_gc(Value *args, Env *env) {
+    return create_number(create_number_ll(gc_collect()));
+}
+
+#include "builtin_table.h"
+
+const char *const builtin_names[] = {
+#define BUILTIN(NAME, FUNC) NAME,
+#define SPECIAL_FORM(NAME, FUNC) NAME,
+#define CONSTANT(NAME, VALUE) NAME,
+#include "builtins.def"
+#undef BUILTIN
+#undef SPECIAL_FORM
+#undef CONSTANT
+};
+
+// Statically allocated so a fresh environment does not allocate anything
+Value *const builtin_values[] = {
+#define BUILTIN(NAME, FUNC) &(Value){ .type = TYPE_BUILTIN, .value.builtin = FUNC, .refs = 1 },
+#define SPECIAL_FORM(NAME, FUNC) &(Value){ .type = TYPE_BUILTIN_SF, .value.builtin = FUNC, .refs = 1 },
+#define CONSTANT(NAME, VALUE) VALUE,
+#include "builtins.def"
+#undef BUILTIN
+#undef SPECIAL_FORM
+#undef CONSTANT
+};
+
+const int builtin_count = sizeof builtin_names / sizeof builtin_names[0];
+
+Value *lookup_builtin(Value *name) {
+    const char *str = name->value.atom;
+    unsigned h = hash_bytes(str, strlen(str));
+    int i = builtin_slots[hash_index(h, BUILTIN_HASH_SEED, BUILTIN_HASH_BITS)];
+
+    if (i >= 0 && !strcmp(builtin_names[i], str)) {
+        return builtin_values[i];
+    }
+    return NULL;
+}
+
+Env *create_global_env(void) {
+    srand(time(NULL));
+    return create_table_env(lookup_builtin);
 }
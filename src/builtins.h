@@ -1,6 +1,18 @@
 #ifndef BUILTINS_H
 #define BUILTINS_H
 
+#include "value.h"
+
 struct Env *create_global_env(void);
 
+// The bindings of a fresh global environment, see builtins.def
+extern const int builtin_count;
+extern const char *const builtin_names[];
+extern Value *const builtin_values[];
+
+Value *lookup_builtin(Value *name);
+
+// Number of frame slots a lambda's operands need, -1 if they are invalid
+int count_slots(Value *operands);
+
 #endif
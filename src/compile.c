@@ -0,0 +1,626 @@
+#include <stdlib.h>
+#include "builtins.h"
+#include "env.h"
+#include "symbol.h"
+#include "vm.h"
+
+// Parameters visible at some point of a function body. parent is NULL when
+// the frames further out are not known until runtime: at the top level, in
+// code passed to eval and in macros, which run in their caller's environment.
+typedef struct Scope Scope;
+struct Scope {
+    Value *operands;
+    Scope *parent;
+};
+
+typedef struct {
+    Code *code;
+    Env *root;  // the global environment, to recognize builtins
+    int depth;  // of the stack at the instruction being emitted
+} Compiler;
+
+// Operand counts, to walk the instructions
+const int op_operands[] = {
+#define OP(NAME, OPERANDS) OPERANDS,
+#include "opcodes.def"
+#undef OP
+};
+
+// The builtins compiled to instructions. Forms are recognized by the value
+// the operator is bound to when compiled, not by name, so aliases like
+// stdlib's do work too.
+static Value *form_quote, *form_lambda, *form_macro, *form_define, *form_set,
+    *form_cond, *form_begin, *form_try, *form_let, *form_if, *form_and, *form_or,
+    *form_when;
+
+static struct {
+    const char *name;
+    enum Opcode op;
+    int args;
+    Value *builtin;
+} primitives[] = {
+    { "+", OP_ADD, 2, NULL },
+    { "-", OP_SUB, 2, NULL },
+    { "<", OP_LT, 2, NULL },
+    { ">", OP_GT, 2, NULL },
+    { "<=", OP_LTE, 2, NULL },
+    { ">=", OP_GTE, 2, NULL },
+    { "=", OP_NUM_EQ, 2, NULL },
+    { "car", OP_CAR, 1, NULL },
+    { "cdr", OP_CDR, 1, NULL },
+    { "cons", OP_CONS, 2, NULL },
+    { "null?", OP_IS_NULL, 1, NULL },
+};
+
+#define NPRIMITIVES (int)(sizeof primitives / sizeof primitives[0])
+
+static void init_forms(void) {
+    if (form_quote != NULL) return;
+
+    form_quote = lookup_builtin(intern("quote"));
+    form_lambda = lookup_builtin(intern("lambda"));
+    form_macro = lookup_builtin(intern("macro"));
+    form_define = lookup_builtin(intern("define"));
+    form_set = lookup_builtin(intern("set!"));
+    form_cond = lookup_builtin(intern("cond"));
+    form_begin = lookup_builtin(intern("begin"));
+    form_try = lookup_builtin(intern("try"));
+    form_let = lookup_builtin(intern("let"));
+    form_if = lookup_builtin(intern("if"));
+    form_and = lookup_builtin(intern("and"));
+    form_or = lookup_builtin(intern("or"));
+    form_when = lookup_builtin(intern("when"));
+
+    for (int i = 0; i < NPRIMITIVES; i++) {
+        primitives[i].builtin = lookup_builtin(intern(primitives[i].name));
+    }
+}
+
+static void *grow(void *items, int *size, int count, size_t item_size) {
+    if (count < *size) return items;
+    *size = *size ? *size * 2 : 16;
+    return realloc(items, *size * item_size);
+}
+
+static int here(Compiler *c) {
+    return c->code->len;
+}
+
+static void emit_word(Compiler *c, intptr_t word) {
+    Code *code = c->code;
+    code->ops = grow(code->ops, &code->size, code->len, sizeof *code->ops);
+    code->ops[code->len++] = word;
+}
+
+// Emits an instruction that changes the stack depth by effect
+static void emit(Compiler *c, enum Opcode op, int effect) {
+    emit_word(c, op);
+    c->depth += effect;
+    if (c->depth > c->code->max_depth) c->code->max_depth = c->depth;
+}
+
+static int add_const(Compiler *c, Value *v) {
+    Code *code = c->code;
+
+    for (int i = 0; i < code->nconsts; i++) {
+        if (code->consts[i] == v) return i;
+    }
+
+    code->consts = grow(code->consts, &code->consts_size, code->nconsts, sizeof *code->consts);
+    code->consts[code->nconsts] = copy_value(v);
+    return code->nconsts++;
+}
+
+static int add_global(Compiler *c, Value *name) {
+    Code *code = c->code;
+
+    for (int i = 0; i < code->nglobals; i++) {
+        if (code->globals[i].name == name) return i;
+    }
+
+    code->globals = grow(code->globals, &code->globals_size, code->nglobals, sizeof *code->globals);
+    code->globals[code->nglobals] = (Global){ name, { NULL, 0 } };
+    return code->nglobals++;
+}
+
+static void add_handler(Compiler *c, int start, int depth) {
+    Code *code = c->code;
+
+    code->handlers = grow(code->handlers, &code->handlers_size, code->nhandlers, sizeof *code->handlers);
+    code->handlers[code->nhandlers++] = (Handler){ start, here(c), here(c), depth };
+}
+
+static Code *new_code(void) {
+    Code *code = calloc(1, sizeof *code);
+    code->refs = 1;
+    return code;
+}
+
+void release_code(Code *code) {
+    if (--code->refs) return;
+
+    for (int i = 0; i < code->nconsts; i++) {
+        delete_value(code->consts[i]);
+    }
+    for (int i = 0; i < code->nprotos; i++) {
+        delete_value(code->protos[i].operands);
+        delete_value(code->protos[i].body);
+        release_code(code->protos[i].code);
+    }
+    free(code->consts);
+    free(code->protos);
+    free(code->globals);
+    free(code->handlers);
+    free(code->ops);
+    free(code);
+}
+
+static int lookup_param(Value *operands, Value *name) {
+    static Value *rest = NULL;
+    if (rest == NULL) rest = intern("&rest");
+
+    int slot = 0;
+    for (Value *op = operands; op != NULL; op = cdr(op)) {
+        if (car(op) == rest) continue;
+        if (car(op) == name) return slot;
+        slot += 1;
+    }
+    return -1;
+}
+
+// Returns the depth (1 + frames up) of the parameter named name, 0 if it is
+// not a parameter
+static int lookup(Scope *scope, Value *name, int *slot) {
+    for (int depth = 1; scope != NULL; scope = scope->parent, depth++) {
+        *slot = lookup_param(scope->operands, name);
+        if (*slot >= 0) return depth;
+    }
+    return 0;
+}
+
+// What a variable that is not a parameter is bound to now, NULL if unbound
+// or if a frame the compiler can't see may bind it
+static Value *global_value(Compiler *c, Scope *scope, Value *name) {
+    Value *v;
+    int slot;
+
+    if (lookup(scope, name, &slot) || name->local) return NULL;
+    if (!resolve(c->root, name, &v)) return NULL;
+    return v;
+}
+
+static int length(Value *ls) {
+    int n = 0;
+    for (; TYPEOF(ls) == TYPE_LIST; ls = CDR(ls)) n++;
+    return n;
+}
+
+static void compile_expr(Compiler *c, Scope *scope, Value *x, int tail);
+static Code *compile_body(Value *body, Value *operands, Scope *parent, Env *root);
+
+static void compile_return(Compiler *c, int tail) {
+    if (tail) emit(c, OP_RETURN, -1);
+}
+
+static void compile_const(Compiler *c, Value *v, int tail) {
+    emit(c, OP_CONST, 1);
+    emit_word(c, add_const(c, v));
+    compile_return(c, tail);
+}
+
+static void compile_ref(Compiler *c, Scope *scope, Value *name, int tail) {
+    int slot, depth = lookup(scope, name, &slot);
+
+    if (depth) {
+        emit(c, OP_LOCAL, 1);
+        emit_word(c, depth);
+        emit_word(c, slot);
+        emit_word(c, add_const(c, name));
+    } else {
+        Value *v = global_value(c, scope, name);
+
+        // #t and #f
+        if (!IS_HEAP(v) && v != NULL && v == lookup_builtin(name)) {
+            compile_const(c, v, tail);
+            return;
+        }
+
+        emit(c, OP_GLOBAL, 1);
+        emit_word(c, add_global(c, name));
+    }
+    compile_return(c, tail);
+}
+
+// Returns 0 if the lambda is invalid, the builtin reports it at runtime
+static int compile_lambda(Compiler *c, Scope *scope, Value *operands, Value *body, enum Type type, int tail) {
+    if (!IS_LIST(operands) || count_slots(operands) < 0) return 0;
+    for (Value *op = operands; op != NULL; op = cdr(op)) {
+        if (TYPEOF(car(op)) != TYPE_ATOM) return 0;
+    }
+    declare_params(operands);
+
+    Code *code = c->code;
+    code->protos = grow(code->protos, &code->protos_size, code->nprotos, sizeof *code->protos);
+
+    Proto *proto = &code->protos[code->nprotos];
+    proto->operands = copy_value(operands);
+    proto->body = copy_value(body);
+    proto->type = type;
+    proto->nslots = count_slots(operands);
+    proto->code = compile_body(body, operands, type == TYPE_FUNCTION ? scope : NULL, c->root);
+
+    emit(c, OP_CLOSURE, 1);
+    emit_word(c, code->nprotos++);
+    compile_return(c, tail);
+    return 1;
+}
+
+static int compile_definition(Compiler *c, Scope *scope, Value *args, enum Opcode op, int tail) {
+    Value *name = car(args);
+
+    if (TYPEOF(name) == TYPE_LIST) {
+        if (TYPEOF(car(name)) != TYPE_ATOM) return 0;
+        if (!compile_lambda(c, scope, cdr(name), car(cdr(args)), TYPE_FUNCTION, 0)) return 0;
+        name = car(name);
+    } else if (TYPEOF(name) == TYPE_ATOM) {
+        // An exception is stored like any other value
+        int start = here(c), depth = c->depth;
+        compile_expr(c, scope, car(cdr(args)), 0);
+        add_handler(c, start, depth);
+    } else {
+        return 0;
+    }
+
+    emit(c, op, 0);
+    emit_word(c, add_const(c, name));
+    compile_return(c, tail);
+    return 1;
+}
+
+static int compile_cond(Compiler *c, Scope *scope, Value *args, int tail) {
+    for (Value *ls = args; ls != NULL; ls = cdr(ls)) {
+        if (TYPEOF(car(ls)) != TYPE_LIST || cdr(car(ls)) == NULL) return 0;
+    }
+
+    int *ends = malloc(length(args) * sizeof *ends);
+    int nends = 0;
+
+    for (; args != NULL; args = cdr(args)) {
+        Value *clause = car(args);
+        int start = here(c), depth = c->depth;
+
+        // A test that raises counts as false
+        compile_expr(c, scope, car(clause), 0);
+        add_handler(c, start, depth);
+
+        emit(c, OP_JUMP_UNLESS_TRUE, -1);
+        int next = here(c);
+        emit_word(c, 0);
+
+        compile_expr(c, scope, car(cdr(clause)), tail);
+        if (!tail) {
+            emit(c, OP_JUMP, 0);
+            ends[nends++] = here(c);
+            emit_word(c, 0);
+        }
+        c->depth = depth;
+
+        c->code->ops[next] = here(c);
+    }
+
+    compile_const(c, NULL, tail);
+    for (int i = 0; i < nends; i++) {
+        c->code->ops[ends[i]] = here(c);
+    }
+    free(ends);
+    return 1;
+}
+
+static void compile_begin(Compiler *c, Scope *scope, Value *args, int tail) {
+    if (args == NULL) {
+        compile_const(c, NULL, tail);
+        return;
+    }
+
+    for (; cdr(args) != NULL; args = cdr(args)) {
+        compile_expr(c, scope, car(args), 0);
+        emit(c, OP_POP, -1);
+    }
+    compile_expr(c, scope, car(args), tail);
+}
+
+// Returns the position of the target operand to fill in
+static int emit_jump(Compiler *c, enum Opcode op, int effect) {
+    emit(c, op, effect);
+    emit_word(c, 0);
+    return here(c) - 1;
+}
+
+static void set_target(Compiler *c, int jump) {
+    c->code->ops[jump] = here(c);
+}
+
+static int compile_if(Compiler *c, Scope *scope, Value *args, int tail) {
+    if (cdr(args) == NULL) return 0;
+
+    int depth = c->depth;
+    compile_expr(c, scope, car(args), 0);
+    int next = emit_jump(c, OP_JUMP_UNLESS_TRUE, -1);
+
+    compile_expr(c, scope, car(cdr(args)), tail);
+    int end = tail ? -1 : emit_jump(c, OP_JUMP, 0);
+    c->depth = depth;
+
+    set_target(c, next);
+    compile_expr(c, scope, car(cdr(cdr(args))), tail);
+    if (end >= 0) set_target(c, end);
+    return 1;
+}
+
+static int compile_when(Compiler *c, Scope *scope, Value *args, int tail) {
+    if (args == NULL) return 0;
+
+    int depth = c->depth;
+    compile_expr(c, scope, car(args), 0);
+    int next = emit_jump(c, OP_JUMP_UNLESS_TRUE, -1);
+
+    compile_begin(c, scope, cdr(args), tail);
+    int end = tail ? -1 : emit_jump(c, OP_JUMP, 0);
+    c->depth = depth;
+
+    set_target(c, next);
+    compile_const(c, NULL, tail);
+    if (end >= 0) set_target(c, end);
+    return 1;
+}
+
+// and, or: every operand but the last ends the form with its value unless it
+// is #t, for and, or unless it isn't, for or
+static void compile_junction(Compiler *c, Scope *scope, Value *args, enum Opcode op, Value *empty, int tail) {
+    if (args == NULL) {
+        compile_const(c, empty, tail);
+        return;
+    }
+
+    int *ends = malloc(length(args) * sizeof *ends);
+    int nends = 0, depth = c->depth;
+
+    for (; cdr(args) != NULL; args = cdr(args)) {
+        compile_expr(c, scope, car(args), 0);
+        ends[nends++] = emit_jump(c, op, -1);
+    }
+    compile_expr(c, scope, car(args), tail);
+
+    if (nends) {
+        c->depth = depth + 1;
+        for (int i = 0; i < nends; i++) {
+            set_target(c, ends[i]);
+        }
+        compile_return(c, tail);
+    }
+    free(ends);
+}
+
+// Compiled as ((lambda (name ...) body) value ...)
+static int compile_let(Compiler *c, Scope *scope, Value *args, int tail) {
+    Value *bindings = car(args);
+    if (cdr(args) == NULL || !IS_LIST(bindings)) return 0;
+
+    for (Value *b = bindings; b != NULL; b = cdr(b)) {
+        Value *binding = car(b);
+        if (TYPEOF(binding) != TYPE_LIST || TYPEOF(car(binding)) != TYPE_ATOM
+                || cdr(binding) == NULL) {
+            return 0;
+        }
+    }
+
+    Value *names = NULL, **next = &names;
+    int n = 0;
+    for (Value *b = bindings; b != NULL; b = cdr(b), n++) {
+        *next = cons(car(car(b)), NULL);
+        next = &CDR(*next);
+    }
+
+    int ok = compile_lambda(c, scope, names, car(cdr(args)), TYPE_FUNCTION, 0);
+    delete_value(names);
+    if (!ok) return 0;
+
+    for (Value *b = bindings; b != NULL; b = cdr(b)) {
+        compile_expr(c, scope, car(cdr(car(b))), 0);
+    }
+
+    if (tail) {
+        emit(c, OP_TAIL_CALL, -(n + 1));
+    } else {
+        emit(c, OP_CALL, -n);
+    }
+    emit_word(c, n);
+    return 1;
+}
+
+static void compile_try(Compiler *c, Scope *scope, Value *args, int tail) {
+    int start = here(c), depth = c->depth;
+
+    compile_expr(c, scope, car(args), 0);
+    add_handler(c, start, depth);
+
+    emit(c, OP_CATCH, 0);
+    int end = here(c);
+    emit_word(c, 0);
+
+    compile_expr(c, scope, car(cdr(args)), 0);
+    emit(c, OP_APPLY_CATCH, -1);
+
+    c->code->ops[end] = here(c);
+    compile_return(c, tail);
+}
+
+// Returns 0 if f is not a form the compiler knows or x is invalid
+static int inline_form(Compiler *c, Scope *scope, Value *x, Value *f, int tail) {
+    Value *args = CDR(x);
+
+    if (f == form_quote) {
+        compile_const(c, car(args), tail);
+        return 1;
+    } else if (f == form_lambda || f == form_macro) {
+        if (cdr(args) == NULL) return 0;
+        return compile_lambda(c, scope, car(args), car(cdr(args)),
+            f == form_lambda ? TYPE_FUNCTION : TYPE_FUNCTION_SF, tail);
+    } else if (f == form_define) {
+        return compile_definition(c, scope, args, OP_DEFINE, tail);
+    } else if (f == form_set) {
+        return compile_definition(c, scope, args, OP_SET, tail);
+    } else if (f == form_cond) {
+        return compile_cond(c, scope, args, tail);
+    } else if (f == form_begin) {
+        compile_begin(c, scope, args, tail);
+        return 1;
+    } else if (f == form_try) {
+        compile_try(c, scope, args, tail);
+        return 1;
+    } else if (f == form_let) {
+        return compile_let(c, scope, args, tail);
+    } else if (f == form_if) {
+        return compile_if(c, scope, args, tail);
+    } else if (f == form_when) {
+        return compile_when(c, scope, args, tail);
+    } else if (f == form_and || f == form_or) {
+        compile_junction(c, scope, args,
+            f == form_and ? OP_JUMP_UNLESS_TRUE_OR_POP : OP_JUMP_IF_TRUE_OR_POP,
+            f == form_and ? TRUE : FALSE, tail);
+        return 1;
+    }
+    return 0;
+}
+
+// The inlined form is only run while its operator is still bound to f, or
+// else x is compiled again when it is reached
+static int compile_form(Compiler *c, Scope *scope, Value *x, Value *f, int tail) {
+    Code *code = c->code;
+    int start = here(c), depth = c->depth;
+    int nconsts = code->nconsts, nglobals = code->nglobals;
+
+    emit(c, OP_FORM, 0);
+    emit_word(c, add_const(c, f));
+    emit_word(c, add_global(c, CAR(x)));
+    emit_word(c, add_const(c, x));
+    int end = here(c);
+    emit_word(c, -1);
+
+    if (!inline_form(c, scope, x, f, tail)) {
+        code->len = start;
+        c->depth = depth;
+        while (code->nconsts > nconsts) delete_value(code->consts[--code->nconsts]);
+        code->nglobals = nglobals;
+        return 0;
+    }
+
+    if (!tail) code->ops[end] = here(c);
+    return 1;
+}
+
+// Returns 0 if x is to be compiled as a call
+static int compile_builtin(Compiler *c, Scope *scope, Value *x, int tail) {
+    Value *f = global_value(c, scope, CAR(x));
+    Value *args = CDR(x);
+
+    if (TYPEOF(f) == TYPE_BUILTIN_SF) return compile_form(c, scope, x, f, tail);
+    if (!IS_BUILTIN(f)) return 0;
+
+    for (int i = 0; i < NPRIMITIVES; i++) {
+        if (f != primitives[i].builtin || length(args) != primitives[i].args) continue;
+
+        for (; args != NULL; args = cdr(args)) {
+            compile_expr(c, scope, car(args), 0);
+        }
+
+        // Room to insert the operator if it has been rebound
+        if (c->depth + 1 > c->code->max_depth) c->code->max_depth = c->depth + 1;
+
+        emit(c, primitives[i].op, 1 - primitives[i].args);
+        emit_word(c, add_const(c, f));
+        emit_word(c, add_global(c, CAR(x)));
+        compile_return(c, tail);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void compile_call(Compiler *c, Scope *scope, Value *x, int tail) {
+    Value *head = CAR(x), *args = CDR(x);
+    int n = length(args);
+    int special = -1;
+
+    compile_expr(c, scope, head, 0);
+
+    // Unless it is obviously a function, the operator may turn out to be a
+    // special form or macro
+    if (TYPEOF(head) != TYPE_LIST || TYPEOF(CAR(head)) != TYPE_ATOM
+            || global_value(c, scope, CAR(head)) != form_lambda) {
+        emit(c, OP_SPECIAL, 0);
+        emit_word(c, add_const(c, args));
+        special = here(c);
+        emit_word(c, 0);
+        emit_word(c, tail);
+    }
+
+    for (; TYPEOF(args) == TYPE_LIST; args = CDR(args)) {
+        compile_expr(c, scope, CAR(args), 0);
+    }
+
+    if (special >= 0) c->code->ops[special] = here(c);
+    if (tail) {
+        emit(c, OP_TAIL_CALL, -(n + 1));
+    } else {
+        emit(c, OP_CALL, -n);
+    }
+    emit_word(c, n);
+}
+
+static void compile_expr(Compiler *c, Scope *scope, Value *x, int tail) {
+    switch (TYPEOF(x)) {
+    case TYPE_ATOM:
+        compile_ref(c, scope, x, tail);
+        break;
+
+    case TYPE_LIST:
+        if (TYPEOF(CAR(x)) == TYPE_ATOM && compile_builtin(c, scope, x, tail)) break;
+        compile_call(c, scope, x, tail);
+        break;
+
+    default:
+        compile_const(c, x, tail);
+        break;
+    }
+}
+
+static Code *compile_body(Value *body, Value *operands, Scope *parent, Env *root) {
+    Scope scope = { operands, parent };
+    Compiler c = { new_code(), root, 0 };
+
+    compile_expr(&c, &scope, body, 1);
+    return c.code;
+}
+
+static Env *root_of(Env *env) {
+    while (env->parent != NULL) env = env->parent;
+    return env;
+}
+
+Code *compile(Value *expr, Env *env) {
+    init_forms();
+
+    Compiler c = { new_code(), root_of(env), 0 };
+    compile_expr(&c, NULL, expr, 1);
+    return c.code;
+}
+
+Code *compile_function(Value *func) {
+    init_forms();
+
+    // The frames it closes over are not known here, its free variables are
+    // looked up by name
+    return compile_body(func->value.func.body, func->value.func.operands, NULL,
+        root_of(func->value.func.env));
+}
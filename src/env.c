@@ -1,19 +1,59 @@
 //#include <stdio.h>
 
 #include <stdlib.h>
-#include <string.h>
+#include "alloc.h"
 #include "env.h"
+#include "gc.h"
+#include "hash.h"
+#include "symbol.h"
 
 Env *create_env(Env *parent) {
-    Env *env = malloc(sizeof *env);
+    return create_frame(parent, 0);
+}
+
+#define FRAME_BYTES(SIZE) (sizeof(Env) + (SIZE) * sizeof(EnvSlot))
+
+// A frame is one allocation: the header followed by `size` parameter slots
+Env *create_frame(Env *parent, int size) {
+    gc_maybe_collect();
+
+    // Frames too big for the slab are not seen by the collector, their
+    // contents are treated as roots
+    Env *env = FRAME_BYTES(size) <= SLAB_MAX_SIZE
+        ? slab_alloc(FRAME_BYTES(size))
+        : malloc(FRAME_BYTES(size));
+    env->type = TYPE_ENV;
+    env->gc = 0;
     env->first = NULL;
+    env->table = NULL;
     env->parent = parent;
     env->refs = 1;
+    env->size = size;
+
+    for (int i = 0; i < size; i++) {
+        env->slots[i].name = NULL;
+        env->slots[i].value = NULL;
+    }
 
     if (parent != NULL) parent->refs += 1;
     return env;
 }
 
+#define TABLE_INITIAL_SIZE 128
+
+// A root environment storing its bindings in a hash table. defaults supplies
+// bindings the environment starts out with, if not NULL.
+Env *create_table_env(Value *(*defaults)(Value *name)) {
+    Env *env = create_frame(NULL, 0);
+
+    env->table = malloc(sizeof *env->table);
+    env->table->size = TABLE_INITIAL_SIZE;
+    env->table->count = 0;
+    env->table->slots = calloc(TABLE_INITIAL_SIZE, sizeof(EnvSlot *));
+    env->table->defaults = defaults;
+    return env;
+}
+
 Env *copy_env(Env *env) {
     env->refs += 1;
     return env;
@@ -23,64 +63,161 @@ void delete_env(Env *env) {
     if (!--env->refs) {
         EnvElem *next;
         for (EnvElem *v = env->first; v != NULL; v = next) {
-            if (delete_value(v->value)) {
-                // There are still other people holding onto this
-                track_value(v->value);
-            }
-
-            free(v->name);
+            delete_value(v->value);
             next = v->next;
             free(v);
         }
+
+        for (int i = 0; i < env->size; i++) {
+            delete_value(env->slots[i].value);
+        }
+
+        if (env->table != NULL) {
+            for (unsigned i = 0; i < env->table->size; i++) {
+                if (env->table->slots[i] != NULL) {
+                    delete_value(env->table->slots[i]->value);
+                    free(env->table->slots[i]);
+                }
+            }
+            free(env->table->slots);
+            free(env->table);
+        }
+
+        if (env->parent != NULL) delete_env(env->parent);
+
+        if (FRAME_BYTES(env->size) <= SLAB_MAX_SIZE) {
+            slab_free(env);
+        } else {
+            free(env);
+        }
+    }
+}
+
+static EnvSlot **table_slot(EnvTable *table, Value *name) {
+    unsigned mask = table->size - 1;
+    unsigned i = hash_ptr(name) & mask;
+
+    while (table->slots[i] != NULL && table->slots[i]->name != name) {
+        i = (i + 1) & mask;
+    }
+    return &table->slots[i];
+}
+
+static void grow_table(EnvTable *table) {
+    EnvSlot **old = table->slots;
+    unsigned old_size = table->size;
+
+    table->size <<= 1;
+    table->slots = calloc(table->size, sizeof(EnvSlot *));
+
+    for (unsigned i = 0; i < old_size; i++) {
+        if (old[i] != NULL) {
+            *table_slot(table, old[i]->name) = old[i];
+        }
     }
+    free(old);
 }
 
-static EnvElem *find_item(Env *env, const char *name) {
+// Returns the binding of name in the table, adding an empty one if create is
+// set
+static EnvSlot *table_find(EnvTable *table, Value *name, int create) {
+    EnvSlot **slot = table_slot(table, name);
+
+    if (*slot == NULL) {
+        Value *v = NULL;
+        if (table->defaults != NULL) v = table->defaults(name);
+        if (v == NULL && !create) return NULL;
+
+        if ((table->count + 1) * 2 > table->size) {
+            grow_table(table);
+            slot = table_slot(table, name);
+        }
+        *slot = malloc(sizeof **slot);
+        (*slot)->name = name;
+        (*slot)->value = copy_value(v);
+        table->count += 1;
+    }
+    return *slot;
+}
+
+static Value **find_item(Env *env, Value *name) {
+    if (env->table != NULL) {
+        EnvSlot *slot = table_find(env->table, name, 0);
+        return slot ? &slot->value : NULL;
+    }
+
+    for (int i = 0; i < env->size; i++) {
+        if (env->slots[i].name == name) {
+            return &env->slots[i].value;
+        }
+    }
+
     for (EnvElem *it = env->first; it != NULL; it = it->next) {
-        if (!strcmp(name, it->name)) {
-            return it;
+        if (it->name == name) {
+            return &it->value;
         }
     }
     return NULL;
 }
 
-static void insert(Env *env, EnvElem *elem, const char *name, Value *v) {
-    if (elem == NULL) {
-        elem = malloc(sizeof *elem);
-        elem->name = strdup(name);
+unsigned env_version = 1;
+
+void declare_local(Value *name) {
+    if (!name->local) {
+        name->local = 1;
+        env_version += 1;
+    }
+}
+
+void declare_params(Value *operands) {
+    for (Value *op = operands; op != NULL; op = cdr(op)) {
+        declare_local(car(op));
+    }
+}
+
+static void insert(Env *env, Value **dst, Value *name, Value *v) {
+    if (dst == NULL && env->table != NULL) {
+        dst = &table_find(env->table, name, 1)->value;
+    }
+
+    if (dst == NULL) {
+        declare_local(name);
+
+        EnvElem *elem = malloc(sizeof *elem);
+        elem->name = name;
         elem->next = env->first;
         env->first = elem;
+        dst = &elem->value;
     } else {
-        delete_value(elem->value);
+        delete_value(*dst);
     }
-    untrack_value(v); // Don't GC track values stored in an environment
-    elem->value = v;
+    *dst = v;
 }
 
 
 // Expects the ref counter to already be incremented
-void add_to_env(Env *env, const char *name, Value *v) {
-    EnvElem *elem = find_item(env, name);
-    insert(env, elem, name, v);
+void add_to_env(Env *env, Value *name, Value *v) {
+    Value **dst = find_item(env, name);
+    insert(env, dst, name, v);
 }
 
 // like add, but will also search parent environments
-void set_in_env(Env *env, const char *name, Value *v) {
+void set_in_env(Env *env, Value *name, Value *v) {
     Env *search_env = env;
-    EnvElem *elem = NULL;
+    Value **dst = NULL;
 
-    while (elem == NULL && search_env != NULL) {
-        elem = find_item(search_env, name);
+    while (dst == NULL && search_env != NULL) {
+        dst = find_item(search_env, name);
         search_env = search_env->parent;
     }
 
-    insert(env, elem, name, v);
+    insert(env, dst, name, v);
 }
 
-int resolve(Env *env, char *name, Value **dst) {
-    EnvElem *item = find_item(env, name);
+int resolve(Env *env, Value *name, Value **dst) {
+    Value **item = find_item(env, name);
     if (item != NULL) {
-        *dst = item->value;
+        *dst = *item;
         return 1;
     }
 
@@ -91,3 +228,165 @@ int resolve(Env *env, char *name, Value **dst) {
         return resolve(env->parent, name, dst);
     }
 }
+
+// A name that was never bound anywhere else can only be bound in the global
+// environment, so its binding there is looked up once and cached in ref
+int resolve_global(Env *env, Value *name, GlobalRef *ref, Value **dst) {
+    if (name->local) return resolve(env, name, dst);
+
+    while (env->parent != NULL) env = env->parent;
+    if (env->table == NULL) return resolve(env, name, dst);
+
+    EnvSlot *slot = table_find(env->table, name, 0);
+    if (slot == NULL) {
+        *dst = NULL;
+        return 0;
+    }
+
+    ref->slot = slot;
+    ref->version = env_version;
+    *dst = slot->value;
+    return 1;
+}
+
+// Like resolve, for the atom in the car of cell. Uses the lexical address left
+// by resolve_lexical() when it is still valid, or the global binding cached
+// in the cell.
+int resolve_cell(Value *cell, Env *env, Value **dst) {
+    Value *name = CAR(cell);
+
+    if (cell->value.list.global.version == env_version) {
+        *dst = cell->value.list.global.slot->value;
+        return 1;
+    }
+
+    if (cell->ref_depth) {
+        Env *frame = env;
+
+        for (int i = 1; i < cell->ref_depth && frame != NULL; i++) {
+            // A define in an inner frame may shadow the parameter, and so may
+            // a frame the address didn't count
+            if (frame->first != NULL) goto slow;
+            for (int j = 0; j < frame->size; j++) {
+                if (frame->slots[j].name == name) goto slow;
+            }
+            frame = frame->parent;
+        }
+
+        if (frame != NULL && cell->ref_slot < frame->size
+                && frame->slots[cell->ref_slot].name == name) {
+            *dst = frame->slots[cell->ref_slot].value;
+            return 1;
+        }
+    }
+
+slow:
+    return resolve_global(env, name, &cell->value.list.global, dst);
+}
+
+static int lookup_param(Value *operands, Value *name) {
+    static Value *rest = NULL;
+    if (rest == NULL) rest = intern("&rest");
+
+    int slot = 0;
+    for (Value *op = operands; op != NULL; op = cdr(op)) {
+        if (car(op) == rest) continue;
+        if (car(op) == name) return slot;
+        slot += 1;
+    }
+    return -1;
+}
+
+// The parameters of the function being resolved, then the names bound by
+// each let around the expression, innermost first. Each one is a frame at
+// run time.
+typedef struct Scope {
+    Value *operands;
+    struct Scope *parent;
+} Scope;
+
+// The names bound by the bindings of a let, NULL if they aren't well formed
+static int let_names(Value *bindings, Value **dst) {
+    Value **next = dst;
+    *dst = NULL;
+
+    for (Value *b = bindings; b != NULL; b = cdr(b)) {
+        if (!IS_LIST(b) || TYPEOF(car(b)) != TYPE_LIST || TYPEOF(car(car(b))) != TYPE_ATOM) {
+            delete_value(*dst);
+            *dst = NULL;
+            return 0;
+        }
+        *next = cons(car(car(b)), NULL);
+        next = &CDR(*next);
+    }
+    return 1;
+}
+
+static void annotate(Value *expr, Scope *scope, Env *env) {
+    static Value *quote = NULL, *lambda, *macro, *let;
+    if (quote == NULL) {
+        quote = intern("quote");
+        lambda = intern("lambda");
+        macro = intern("macro");
+        let = intern("let");
+    }
+
+    for (Value *cell = expr; TYPEOF(cell) == TYPE_LIST; cell = CDR(cell)) {
+        Value *item = CAR(cell);
+
+        if (TYPEOF(item) == TYPE_LIST) {
+            // Nested functions are resolved when they are created
+            Value *head = CAR(item);
+            Value *names;
+
+            if (head == let && TYPEOF(cdr(item)) == TYPE_LIST && let_names(car(cdr(item)), &names)) {
+                // The values are evaluated outside the let's frame, the body in it
+                Scope inner = { names, scope };
+                annotate(car(cdr(item)), scope, env);
+                annotate(cdr(cdr(item)), &inner, env);
+                delete_value(names);
+            } else if (head != quote && head != lambda && head != macro) {
+                annotate(item, scope, env);
+            }
+            continue;
+        } else if (TYPEOF(item) != TYPE_ATOM) {
+            continue;
+        }
+
+        cell->ref_depth = 0;
+
+        int slot = -1, depth = 1;
+        for (Scope *s = scope; s != NULL && slot < 0; s = s->parent, depth++) {
+            slot = lookup_param(s->operands, item);
+        }
+        if (slot >= 0) {
+            cell->ref_depth = depth - 1;
+            cell->ref_slot = slot;
+            continue;
+        }
+
+        for (Env *frame = env; frame != NULL && frame->first == NULL; frame = frame->parent) {
+            for (slot = 0; slot < frame->size; slot++) {
+                if (frame->slots[slot].name == item) break;
+            }
+
+            if (slot < frame->size) {
+                cell->ref_depth = depth;
+                cell->ref_slot = slot;
+                break;
+            }
+            depth += 1;
+        }
+    }
+}
+
+// Resolution pass run when a function is created: every variable in body that
+// names a parameter of the function, or of an enclosing frame in env, gets
+// its (depth, slot) address stored in the list cell holding it. Lookups then
+// go straight to the slot instead of searching frames by name.
+void resolve_lexical(Value *body, Value *operands, Env *env) {
+    Scope scope = { operands, NULL };
+
+    declare_params(operands);
+    annotate(body, &scope, env);
+}
@@ -3,31 +3,82 @@
 
 struct Env;
 struct EnvElem;
+struct EnvSlot;
+struct EnvTable;
 typedef struct Env Env;
 typedef struct EnvElem EnvElem;
+typedef struct EnvSlot EnvSlot;
+typedef struct EnvTable EnvTable;
+
+// Where a variable was last found in the global environment, kept at the
+// place it is used. Valid while version equals env_version.
+typedef struct {
+    EnvSlot *slot;
+    unsigned version;
+} GlobalRef;
 
 #include "value.h"
 
 struct EnvElem {
-    char *name;
+    Value *name; // interned atom
     Value *value;
     EnvElem *next;
 };
 
+struct EnvSlot {
+    Value *name;
+    Value *value;
+};
+
+// Open addressing table of bindings, used by the global environment. Each
+// binding is allocated on its own so it stays put when the table grows.
+struct EnvTable {
+    unsigned size, count; // size is a power of two
+    EnvSlot **slots;      // NULL for empty slots
+
+    // Bindings that are not in the table yet, materialized on first use
+    Value *(*defaults)(Value *name);
+};
+
 struct Env {
+    enum Type type; // TYPE_ENV
     int refs;
-    EnvElem *first;
+    unsigned gc;    // scratch space for the collector
+    EnvElem *first; // bindings created by define
+    EnvTable *table;
     Env *parent;
+
+    // The parameters of a function call, see resolve_lexical()
+    int size;
+    EnvSlot slots[];
 };
 
 Env *create_env(Env *parent);
+Env *create_frame(Env *parent, int size);
+Env *create_table_env(Value *(*defaults)(Value *name));
 Env *copy_env(Env *env);
 void delete_env(Env *env);
 
+// Names are interned atoms, see symbol.h
 // Do NOT increment the ref counter
-void add_to_env(Env *env, const char *name, Value *v);
-void set_in_env(Env *env, const char *name, Value *v);
+void add_to_env(Env *env, Value *name, Value *v);
+void set_in_env(Env *env, Value *name, Value *v);
+
+// Bumped whenever a name is bound outside the global environment for the
+// first time, which makes every GlobalRef stale
+extern unsigned env_version;
+
+// Records that name, or the parameters in operands, will be bound in frames
+void declare_local(Value *name);
+void declare_params(Value *operands);
+
+int resolve(Env *env, Value *name, Value **dst);
+int resolve_cell(Value *cell, Env *env, Value **dst);
+
+// Like resolve, also caching the binding in ref if it can only be the global
+// one
+int resolve_global(Env *env, Value *name, GlobalRef *ref, Value **dst);
 
-int resolve(Env *env, char *name, Value **dst);
+void resolve_lexical(Value *body, Value *operands, Env *env);
 
 #endif
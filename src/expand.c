@@ -0,0 +1,191 @@
+#include "builtins.h"
+#include "env.h"
+#include "expand.h"
+#include "interpreter.h"
+#include "symbol.h"
+
+unsigned macro_count = 0;
+
+// Expansions that expand to macro calls again, any deeper is taken to be
+// infinite
+#define MAX_NESTING 1000
+
+// Names bound around a form by functions and lets, they shadow macros
+typedef struct Scope Scope;
+struct Scope {
+    Value *names;
+    Scope *parent;
+};
+
+// Forms are recognized by the value their operator is bound to, like in the
+// compiler
+static Value *form_quote, *form_quasiquote, *form_lambda, *form_macro,
+    *form_define, *form_define_macro, *form_let;
+static Value *quasiquote, *unquote, *unquote_splicing;
+
+static int nesting = 0;
+
+static void init_forms(void) {
+    if (form_quote != NULL) return;
+
+    form_quote = lookup_builtin(intern("quote"));
+    form_quasiquote = lookup_builtin(intern("quasiquote"));
+    form_lambda = lookup_builtin(intern("lambda"));
+    form_macro = lookup_builtin(intern("macro"));
+    form_define = lookup_builtin(intern("define"));
+    form_define_macro = lookup_builtin(intern("define-macro"));
+    form_let = lookup_builtin(intern("let"));
+
+    quasiquote = intern("quasiquote");
+    unquote = intern("unquote");
+    unquote_splicing = intern("unquote-splicing");
+}
+
+static int in_scope(Scope *scope, Value *name) {
+    for (; scope != NULL; scope = scope->parent) {
+        for (Value *n = scope->names; n != NULL; n = cdr(n)) {
+            if (car(n) == name) return 1;
+        }
+    }
+    return 0;
+}
+
+// What the operator of a form is bound to, NULL for locals
+static Value *operator(Value *head, Scope *scope, Env *env) {
+    Value *v;
+
+    if (TYPEOF(head) != TYPE_ATOM || in_scope(scope, head)) return NULL;
+    if (!resolve(env, head, &v)) return NULL;
+    return v;
+}
+
+static Value *expand_in(Value *x, int level, Scope *scope, Env *env);
+
+// Expands the items of ls after the first skip. The result shares the
+// longest unchanged tail with ls, or is ls itself. Returns the exception if
+// expanding an item raises one.
+static Value *expand_items(Value *ls, int skip, int level, Scope *scope, Env *env) {
+    Value *ret = NULL, **next = &ret;
+    Value *copied = ls; // items before this are in ret
+
+    for (Value *it = ls; TYPEOF(it) == TYPE_LIST; it = CDR(it), skip--) {
+        if (skip > 0) continue;
+
+        Value *item = expand_in(CAR(it), level, scope, env);
+        if (TYPEOF(item) == TYPE_EXCEPTION) {
+            delete_value(ret);
+            return item;
+        }
+        if (item == CAR(it)) {
+            delete_value(item);
+            continue;
+        }
+
+        for (; copied != it; copied = CDR(copied)) {
+            *next = cons(copy_value(CAR(copied)), NULL);
+            next = &CDR(*next);
+        }
+        *next = cons(item, NULL);
+        next = &CDR(*next);
+        copied = CDR(it);
+    }
+
+    if (copied == ls) return copy_value(ls);
+    *next = copy_value(copied);
+    return ret;
+}
+
+// (let ((name value) ...) body): the names are in scope in the body only
+static Value *expand_let(Value *x, Scope *scope, Env *env) {
+    Value *bindings = car(CDR(x));
+    if (!IS_LIST(bindings)) return copy_value(x);
+
+    Value *expanded = NULL, **next = &expanded;
+    Value *names = NULL, **next_name = &names;
+
+    for (Value *b = bindings; b != NULL; b = cdr(b)) {
+        Value *binding = car(b);
+        Value *v = TYPEOF(binding) == TYPE_LIST
+            ? expand_items(binding, 1, 0, scope, env)
+            : copy_value(binding);
+
+        if (TYPEOF(v) == TYPE_EXCEPTION) {
+            delete_value(expanded);
+            delete_value(names);
+            return v;
+        }
+        *next = cons(v, NULL);
+        next = &CDR(*next);
+
+        *next_name = cons(copy_value(car(binding)), NULL);
+        next_name = &CDR(*next_name);
+    }
+
+    Scope inner = { names, scope };
+    Value *body = expand_items(cdr(CDR(x)), 0, 0, &inner, env);
+    delete_value(names);
+
+    if (TYPEOF(body) == TYPE_EXCEPTION) {
+        delete_value(expanded);
+        return body;
+    }
+    return cons(copy_value(CAR(x)), cons(expanded, body));
+}
+
+// Inside level nested quasiquotes only what is unquoted as often is code
+static Value *expand_template(Value *x, int level, Scope *scope, Env *env) {
+    Value *head = CAR(x);
+
+    if (head == unquote || head == unquote_splicing) {
+        level -= 1;
+    } else if (head == quasiquote) {
+        level += 1;
+    }
+    return expand_items(x, level ? 0 : 1, level, scope, env);
+}
+
+static Value *expand_in(Value *x, int level, Scope *scope, Env *env) {
+    if (TYPEOF(x) != TYPE_LIST) return copy_value(x);
+    if (level > 0) return expand_template(x, level, scope, env);
+
+    Value *f = operator(CAR(x), scope, env);
+
+    if (TYPEOF(f) == TYPE_MACRO) {
+        if (nesting >= MAX_NESTING) {
+            return create_exception("Expansion of '%s' does not terminate", CAR(x)->value.atom);
+        }
+
+        Value *expansion = apply_macro(f, CDR(x));
+        if (TYPEOF(expansion) == TYPE_EXCEPTION) return expansion;
+
+        nesting += 1;
+        Value *ret = expand_in(expansion, 0, scope, env);
+        nesting -= 1;
+
+        delete_value(expansion);
+        return ret;
+    } else if (f == form_quote) {
+        return copy_value(x);
+    } else if (f == form_quasiquote) {
+        return expand_items(x, 1, 1, scope, env);
+    } else if (f == form_lambda || f == form_macro) {
+        // (lambda params body)
+        Scope inner = { car(CDR(x)), scope };
+        return expand_items(x, 2, 0, &inner, env);
+    } else if ((f == form_define || f == form_define_macro) && TYPEOF(car(CDR(x))) == TYPE_LIST) {
+        // (define (name params) body)
+        Scope inner = { cdr(car(CDR(x))), scope };
+        return expand_items(x, 2, 0, &inner, env);
+    } else if (f == form_let) {
+        return expand_let(x, scope, env);
+    }
+
+    return expand_items(x, 0, 0, scope, env);
+}
+
+Value *expand(Value *expr, Env *env) {
+    if (macro_count == 0) return copy_value(expr);
+
+    init_forms();
+    return expand_in(expr, 0, NULL, env);
+}
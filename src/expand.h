@@ -0,0 +1,17 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+
+#include "value.h"
+
+// Macros defined with define-macro are functions from the operands of a call
+// to the code that replaces it. Forms are expanded once, as they are read by
+// run_script, the REPL or eval, before they are evaluated.
+
+// Returns expr, which is to be evaluated in env, with its macro calls
+// replaced by their expansions. Parts without any are shared with expr.
+Value *expand(Value *expr, Env *env);
+
+// Counts the macros created, nothing is expanded before the first
+extern unsigned macro_count;
+
+#endif
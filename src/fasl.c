@@ -0,0 +1,513 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "alloc.h"
+#include "fasl.h"
+#include "hash.h"
+#include "symbol.h"
+
+#ifdef __unix__
+#include <sys/stat.h>
+#endif
+
+// After the header come the forms, each written in preorder as a tag byte
+// followed by:
+//
+//   FASL_FIXNUM     the value, zigzag encoded
+//   FASL_CHAR       the character byte
+//   FASL_NUMBER     number type byte, 8 bytes of value
+//   FASL_BIGINT     limb count << 1 | sign, limbs
+//   FASL_STRING     length, text
+//   FASL_EXCEPTION  length, message
+//   FASL_NEW_ATOM   length, name; the atom gets the next number
+//   FASL_ATOM       number of an atom seen before
+//   FASL_LIST       length, elements
+//   FASL_VECTOR     length, items
+//
+// Counts and lengths are LEB128. Everything else is in the byte order of the
+// machine that wrote the file.
+
+#define FASL_MAGIC "FSFASL"
+#define FASL_VERSION 3
+
+enum {
+    FASL_NULL,
+    FASL_TRUE,
+    FASL_FALSE,
+    FASL_FIXNUM,
+    FASL_CHAR,
+    FASL_NUMBER,
+    FASL_STRING,
+    FASL_EXCEPTION,
+    FASL_NEW_ATOM,
+    FASL_ATOM,
+    FASL_LIST,
+    FASL_VECTOR,
+    FASL_BIGINT,
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t hash;      // of the source text
+    uint32_t checksum;  // of the forms
+    uint32_t unused;
+    uint64_t size;      // of the source
+    int64_t mtime, mtime_nsec;
+    uint64_t length;    // of the forms
+} Header;
+
+struct Fasl {
+    char *path; // of the cache
+    Value **atoms;
+    size_t atom_count, atoms_size;
+
+    // Reading
+    const unsigned char *data, *p, *end;
+    size_t size;
+    int bad;
+
+    // Writing, atoms are numbered through an open addressing table
+    FILE *out;
+    char *temp;
+    Header header;
+    unsigned *numbers;
+    size_t table_size;
+    int failed;
+};
+
+static char *fasl_path(const char *script, const char *suffix) {
+    size_t len = strlen(script) + strlen(suffix) + 1;
+    char *path = malloc(len);
+    snprintf(path, len, "%s%s", script, suffix);
+    return path;
+}
+
+#ifdef __unix__
+// What the cache of source is checked against, but the hash
+static int source_header(FILE *source, Header *header) {
+    struct stat st;
+    if (fstat(fileno(source), &st) || !S_ISREG(st.st_mode) || st.st_size == 0) return 0;
+
+    memset(header, 0, sizeof *header);
+    memcpy(header->magic, FASL_MAGIC, sizeof FASL_MAGIC);
+    header->version = FASL_VERSION;
+    header->size = st.st_size;
+    header->mtime = st.st_mtim.tv_sec;
+    header->mtime_nsec = st.st_mtim.tv_nsec;
+    return 1;
+}
+
+static uint32_t source_hash(const char *script) {
+    size_t size;
+    const char *text = map_file(script, &size);
+    if (text == NULL) return 0;
+
+    uint32_t h = hash_bytes(text, size);
+    unmap_file(text, size);
+    return h;
+}
+#endif
+
+// Removes the cache at path, which doesn't decode, so the script is read
+// again and a new one made
+static void discard_damaged(const char *path) {
+    fprintf(stderr, "Warning: the cache '%s' is damaged, reading the script instead\n", path);
+    remove(path);
+}
+
+static void add_atom(Fasl *fasl, Value *atom) {
+    if (fasl->atom_count == fasl->atoms_size) {
+        fasl->atoms_size = fasl->atoms_size ? fasl->atoms_size * 2 : 256;
+        fasl->atoms = realloc(fasl->atoms, fasl->atoms_size * sizeof *fasl->atoms);
+    }
+    fasl->atoms[fasl->atom_count++] = atom;
+}
+
+// Reading
+
+static int get_byte(Fasl *fasl) {
+    if (fasl->p == fasl->end) {
+        fasl->bad = 1;
+        return 0;
+    }
+    return *fasl->p++;
+}
+
+static uint64_t get_count(Fasl *fasl) {
+    uint64_t x = 0;
+    int shift = 0, byte;
+
+    do {
+        byte = get_byte(fasl);
+        if (shift < 64) x |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    return x;
+}
+
+// Returns len bytes in place
+static const char *get_bytes(Fasl *fasl, uint64_t len) {
+    if ((uint64_t)(fasl->end - fasl->p) < len) {
+        fasl->bad = 1;
+        return NULL;
+    }
+    const char *bytes = (const char *)fasl->p;
+    fasl->p += len;
+    return bytes;
+}
+
+static char *get_text(Fasl *fasl) {
+    uint64_t len = get_count(fasl);
+    const char *bytes = get_bytes(fasl, len);
+    if (bytes == NULL) return NULL;
+
+    char *text = malloc(len + 1);
+    memcpy(text, bytes, len);
+    text[len] = 0;
+    return text;
+}
+
+static Value *get_form(Fasl *fasl) {
+    int tag = get_byte(fasl);
+    uint64_t n;
+    Number number;
+    BigInt *big;
+    const char *bytes;
+    char *text;
+    Value *v;
+
+    switch (tag) {
+    case FASL_NULL:
+        return NULL;
+    case FASL_TRUE:
+        return TRUE;
+    case FASL_FALSE:
+        return FALSE;
+    case FASL_FIXNUM:
+        n = get_count(fasl);
+        return FIXNUM((intptr_t)(n >> 1) ^ -(intptr_t)(n & 1));
+    case FASL_CHAR:
+        return CHAR(get_byte(fasl));
+    case FASL_NUMBER:
+        number.type = get_byte(fasl);
+        bytes = get_bytes(fasl, sizeof number.v);
+        if (bytes == NULL || number.type > NUMBER_DOUBLE) break;
+        memcpy(&number.v, bytes, sizeof number.v);
+        return create_number(number);
+    case FASL_BIGINT:
+        n = get_count(fasl);
+        if (n >> 1 > (uint64_t)(fasl->end - fasl->p) / sizeof(uint32_t)) break;
+        bytes = get_bytes(fasl, (n >> 1) * sizeof(uint32_t));
+        if (bytes == NULL || n >> 1 == 0) break;
+
+        big = create_bigint(n >> 1, n & 1);
+        memcpy(big->limbs, bytes, big->len * sizeof big->limbs[0]);
+        if (big->limbs[big->len - 1] == 0) {
+            free_bigint(big);
+            break;
+        }
+        return create_number(create_number_big(big));
+    case FASL_STRING:
+        n = get_count(fasl);
+        text = (char *)get_bytes(fasl, n);
+        if (text == NULL) break;
+        return create_string_len(text, n);
+    case FASL_EXCEPTION:
+        text = get_text(fasl);
+        if (text == NULL) break;
+        v = create_value(TYPE_EXCEPTION);
+        v->value.exception = text;
+        return v;
+    case FASL_NEW_ATOM:
+        n = get_count(fasl);
+        bytes = get_bytes(fasl, n);
+        if (bytes == NULL) break;
+        add_atom(fasl, intern_n(bytes, n));
+        return fasl->atoms[fasl->atom_count - 1];
+    case FASL_ATOM:
+        n = get_count(fasl);
+        if (n >= fasl->atom_count) break;
+        return fasl->atoms[n];
+    case FASL_LIST: {
+        Value *ls = NULL, **next = &ls;
+
+        n = get_count(fasl);
+        for (uint64_t i = 0; i < n && !fasl->bad; i++) {
+            *next = cons(get_form(fasl), NULL);
+            next = &CDR(*next);
+        }
+        if (n > 0) return ls;
+        break;
+    }
+    case FASL_VECTOR:
+        n = get_count(fasl);
+        if (n > (uint64_t)(fasl->end - fasl->p)) break;
+
+        v = create_vector(n, NULL);
+        for (uint64_t i = 0; i < n && !fasl->bad; i++) {
+            v->value.vector.items[i] = get_form(fasl);
+        }
+        return v;
+    default:
+        break;
+    }
+
+    fasl->bad = 1;
+    return NULL;
+}
+
+Fasl *open_fasl(const char *script, FILE *source) {
+#ifdef __unix__
+    Header expected, header;
+    if (!source_header(source, &expected)) return NULL;
+
+    char *path = fasl_path(script, ".fasl");
+    size_t size;
+    const unsigned char *data = map_file(path, &size);
+    if (data == NULL) {
+        free(path);
+        return NULL;
+    }
+
+    if (size < sizeof header) {
+        unmap_file(data, size);
+        free(path);
+        return NULL;
+    }
+    memcpy(&header, data, sizeof header);
+
+    // A new modification time alone, as after a copy, doesn't make the cache
+    // stale
+    if (memcmp(header.magic, expected.magic, sizeof header.magic)
+            || header.version != expected.version
+            || header.size != expected.size
+            || header.length != size - sizeof header
+            || ((header.mtime != expected.mtime || header.mtime_nsec != expected.mtime_nsec)
+                && header.hash != source_hash(script))) {
+        unmap_file(data, size);
+        free(path);
+        return NULL;
+    }
+
+    if (hash_bytes((const char *)data + sizeof header, header.length) != header.checksum) {
+        discard_damaged(path);
+        unmap_file(data, size);
+        free(path);
+        return NULL;
+    }
+
+    Fasl *fasl = calloc(1, sizeof *fasl);
+    fasl->data = data;
+    fasl->size = size;
+    fasl->path = path;
+    fasl->p = data + sizeof header;
+    fasl->end = data + size;
+    return fasl;
+#else
+    return NULL;
+#endif
+}
+
+int read_fasl(Fasl *fasl, Value **dst) {
+    if (fasl->bad) return -1;
+    if (fasl->p == fasl->end) return 0;
+
+    *dst = get_form(fasl);
+    if (fasl->bad) {
+        delete_value(*dst);
+        discard_damaged(fasl->path);
+        return -1;
+    }
+    return 1;
+}
+
+void close_fasl(Fasl *fasl) {
+    unmap_file(fasl->data, fasl->size);
+    free(fasl->path);
+    free(fasl->atoms);
+    free(fasl);
+}
+
+// Writing
+
+static void put_byte(Fasl *fasl, int byte) {
+    putc(byte, fasl->out);
+}
+
+static void put_count(Fasl *fasl, uint64_t x) {
+    while (x >= 0x80) {
+        put_byte(fasl, (x & 0x7f) | 0x80);
+        x >>= 7;
+    }
+    put_byte(fasl, x);
+}
+
+static void put_bytes(Fasl *fasl, const char *bytes, size_t len) {
+    put_count(fasl, len);
+    fwrite(bytes, 1, len, fasl->out);
+}
+
+static void put_text(Fasl *fasl, const char *text) {
+    put_bytes(fasl, text, strlen(text));
+}
+
+// The number of atom, or atom_count if it hasn't got one yet
+static unsigned *atom_number(Fasl *fasl, Value *atom) {
+    size_t mask = fasl->table_size - 1;
+    size_t i = hash_ptr(atom) & mask;
+
+    while (fasl->numbers[i] != UINT32_MAX && fasl->atoms[fasl->numbers[i]] != atom) {
+        i = (i + 1) & mask;
+    }
+    return &fasl->numbers[i];
+}
+
+static void number_atom(Fasl *fasl, Value *atom) {
+    if ((fasl->atom_count + 1) * 2 > fasl->table_size) {
+        free(fasl->numbers);
+        fasl->table_size = fasl->table_size ? fasl->table_size * 2 : 512;
+        fasl->numbers = malloc(fasl->table_size * sizeof *fasl->numbers);
+        memset(fasl->numbers, 0xff, fasl->table_size * sizeof *fasl->numbers);
+
+        for (size_t i = 0; i < fasl->atom_count; i++) {
+            *atom_number(fasl, fasl->atoms[i]) = i;
+        }
+    }
+
+    add_atom(fasl, atom);
+    *atom_number(fasl, atom) = fasl->atom_count - 1;
+}
+
+static void put_form(Fasl *fasl, Value *v) {
+    unsigned *number;
+    uint64_t n = 0;
+
+    switch (TYPEOF(v)) {
+    case TYPE_NULL:
+        put_byte(fasl, FASL_NULL);
+        break;
+    case TYPE_BOOLEAN:
+        put_byte(fasl, v == TRUE ? FASL_TRUE : FASL_FALSE);
+        break;
+    case TYPE_CHAR:
+        put_byte(fasl, FASL_CHAR);
+        put_byte(fasl, CHAR_VALUE(v));
+        break;
+    case TYPE_NUMBER:
+        if (IS_FIXNUM(v)) {
+            intptr_t x = FIXNUM_VALUE(v);
+            put_byte(fasl, FASL_FIXNUM);
+            put_count(fasl, ((uint64_t)x << 1) ^ (uint64_t)(x >> (sizeof x * 8 - 1)));
+        } else if (v->value.number.type == NUMBER_BIGINT) {
+            BigInt *big = v->value.number.v.big;
+            put_byte(fasl, FASL_BIGINT);
+            put_count(fasl, (uint64_t)big->len << 1 | big->neg);
+            fwrite(big->limbs, sizeof big->limbs[0], big->len, fasl->out);
+        } else {
+            put_byte(fasl, FASL_NUMBER);
+            put_byte(fasl, v->value.number.type);
+            fwrite(&v->value.number.v, sizeof v->value.number.v, 1, fasl->out);
+        }
+        break;
+    case TYPE_STRING:
+        put_byte(fasl, FASL_STRING);
+        put_bytes(fasl, string_chars(v), string_len(v));
+        break;
+    case TYPE_EXCEPTION:
+        put_byte(fasl, FASL_EXCEPTION);
+        put_text(fasl, v->value.exception);
+        break;
+    case TYPE_ATOM:
+        number = fasl->table_size ? atom_number(fasl, v) : NULL;
+        if (number != NULL && *number != UINT32_MAX) {
+            put_byte(fasl, FASL_ATOM);
+            put_count(fasl, *number);
+        } else {
+            number_atom(fasl, v);
+            put_byte(fasl, FASL_NEW_ATOM);
+            put_text(fasl, v->value.atom);
+        }
+        break;
+    case TYPE_LIST:
+        for (Value *it = v; it != NULL; it = CDR(it)) n++;
+        put_byte(fasl, FASL_LIST);
+        put_count(fasl, n);
+        for (Value *it = v; it != NULL; it = CDR(it)) put_form(fasl, CAR(it));
+        break;
+    case TYPE_VECTOR:
+        put_byte(fasl, FASL_VECTOR);
+        put_count(fasl, v->value.vector.len);
+        for (size_t i = 0; i < v->value.vector.len; i++) {
+            put_form(fasl, v->value.vector.items[i]);
+        }
+        break;
+    default:
+        // The reader doesn't make anything else
+        fasl->failed = 1;
+        break;
+    }
+}
+
+Fasl *create_fasl(const char *script, FILE *source) {
+#ifdef __unix__
+    Header header;
+    if (!source_header(source, &header)) return NULL;
+
+    char *temp = fasl_path(script, ".fasl.tmp");
+    FILE *out = fopen(temp, "wb");
+    if (out == NULL) {
+        free(temp);
+        return NULL;
+    }
+
+    Fasl *fasl = calloc(1, sizeof *fasl);
+    fasl->out = out;
+    fasl->path = fasl_path(script, ".fasl");
+    fasl->temp = temp;
+    fasl->header = header;
+    fasl->header.hash = source_hash(script);
+
+    // Written again with the length once the forms are in
+    fwrite(&fasl->header, sizeof fasl->header, 1, out);
+    return fasl;
+#else
+    return NULL;
+#endif
+}
+
+void write_fasl(Fasl *fasl, Value *form) {
+    if (!fasl->failed) put_form(fasl, form);
+}
+
+void finish_fasl(Fasl *fasl) {
+    long end = ftell(fasl->out);
+
+    if (!fasl->failed && end >= (long)sizeof fasl->header && !fflush(fasl->out)) {
+        // Summed from the file, as the forms go out in pieces
+        size_t size;
+        const char *data = map_file(fasl->temp, &size);
+        if (data != NULL && size == (size_t)end) {
+            fasl->header.length = end - sizeof fasl->header;
+            fasl->header.checksum = hash_bytes(data + sizeof fasl->header, fasl->header.length);
+        } else {
+            fasl->failed = 1;
+        }
+        if (data != NULL) unmap_file(data, size);
+
+        fseek(fasl->out, 0, SEEK_SET);
+        fwrite(&fasl->header, sizeof fasl->header, 1, fasl->out);
+    }
+
+    if ((ferror(fasl->out) | fclose(fasl->out)) || fasl->failed
+            || rename(fasl->temp, fasl->path)) {
+        remove(fasl->temp);
+    }
+
+    free(fasl->path);
+    free(fasl->temp);
+    free(fasl->atoms);
+    free(fasl->numbers);
+    free(fasl);
+}
@@ -0,0 +1,34 @@
+#ifndef FASL_H
+#define FASL_H
+
+#include <stdio.h>
+#include "value.h"
+
+// A FASL ("fast load") file caches the parsed top-level forms of a script
+// next to it, in script.fasl, so running the script again needs no parsing.
+// It is used while the script has the size and the modification time, or
+// else the contents, it was made from.
+
+typedef struct Fasl Fasl;
+
+// The cache of script, whose source file is open as source, or NULL if it has
+// none that is up to date. A cache whose forms don't match their checksum is
+// removed.
+Fasl *open_fasl(const char *script, FILE *source);
+
+// Reads the next form into dst, returns 0 after the last one. Returns -1 if
+// the cache turns out damaged, which removes it; the forms still to run
+// have to come from the script.
+int read_fasl(Fasl *fasl, Value **dst);
+
+void close_fasl(Fasl *fasl);
+
+// Starts a new cache for script, NULL if it can't be written
+Fasl *create_fasl(const char *script, FILE *source);
+
+void write_fasl(Fasl *fasl, Value *form);
+
+// Puts the cache in place, or discards it if it couldn't be written in full
+void finish_fasl(Fasl *fasl);
+
+#endif
@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include "env.h"
+#include "gc.h"
+#include "hashtable.h"
+#include "value.h"
+
+// Cycle collection works like CPython's: every object's references from other
+// heap objects are subtracted from its refcount. Whatever is left over comes
+// from outside the heap (the C stack, the REPL, main's global_env), so those
+// objects are the roots. Anything not reachable from a root is garbage.
+//
+// A minor collection only looks at the nursery. References into it from old
+// objects are not subtracted, so they keep their targets alive like the C
+// stack does: the refcounts double as the remembered set a write barrier
+// would otherwise have to maintain. Cycles that reach into the old
+// generation are left for the next full collection.
+//
+// The gc word of each object holds these flags and, during a collection, the
+// number of references from outside the heap.
+
+#define GC_CANDIDATE 0x80000000u // allocated from the slab, not an atom
+#define GC_MARK      0x40000000u // reachable from a root
+#define GC_COUNT     0x3fffffffu
+
+typedef struct {
+    void **items;
+    size_t count, size;
+} Stack;
+
+static Stack stack = { NULL, 0, 0 };
+static Stack garbage = { NULL, 0, 0 };
+
+size_t gc_threshold = GC_MIN_HEAP;
+size_t gc_young_threshold = GC_NURSERY_SIZE;
+
+static void push(Stack *s, void *p) {
+    if (s->count == s->size) {
+        s->size = s->size ? s->size * 2 : 1024;
+        s->items = realloc(s->items, s->size * sizeof *s->items);
+    }
+    s->items[s->count++] = p;
+}
+
+static int is_env(void *obj) {
+    return *(enum Type *)obj == TYPE_ENV;
+}
+
+static unsigned *gc_word(void *obj) {
+    return is_env(obj) ? &((Env *)obj)->gc : &((Value *)obj)->gc;
+}
+
+static int is_candidate(void *obj) {
+    return obj != NULL && (*gc_word(obj) & GC_CANDIDATE);
+}
+
+static void each_value(Value *v, void (*fn)(void *child)) {
+    if (IS_HEAP(v)) fn(v);
+}
+
+static void each_entry(HashEntry *e, void *data) {
+    void (*fn)(void *child) = *(void (**)(void *))data;
+    each_value(e->key, fn);
+    each_value(e->value, fn);
+}
+
+static void clear_entry(HashEntry *e, void *data) {
+    e->key = e->value = NULL;
+}
+
+// Calls fn on every object obj holds a reference to
+static void each_child(void *obj, void (*fn)(void *child)) {
+    if (is_env(obj)) {
+        Env *env = obj;
+
+        if (env->parent) fn(env->parent);
+        for (int i = 0; i < env->size; i++) {
+            each_value(env->slots[i].value, fn);
+        }
+        for (EnvElem *elem = env->first; elem != NULL; elem = elem->next) {
+            each_value(elem->value, fn);
+        }
+        for (unsigned i = 0; env->table && i < env->table->size; i++) {
+            if (env->table->slots[i]) each_value(env->table->slots[i]->value, fn);
+        }
+        return;
+    }
+
+    Value *v = obj;
+    switch (v->type) {
+    case TYPE_LIST:
+        each_value(CAR(v), fn);
+        each_value(CDR(v), fn);
+        break;
+    case TYPE_FUNCTION:
+    case TYPE_FUNCTION_SF:
+    case TYPE_MACRO:
+        each_value(v->value.func.operands, fn);
+        each_value(v->value.func.body, fn);
+        if (v->value.func.env) fn(v->value.func.env);
+        break;
+    case TYPE_VECTOR:
+        for (size_t i = 0; i < v->value.vector.len; i++) {
+            each_value(v->value.vector.items[i], fn);
+        }
+        break;
+    case TYPE_HASHTABLE:
+        hashtable_each(v->value.hashtable, each_entry, &fn);
+        break;
+    default:
+        break;
+    }
+}
+
+// Drops obj's references without freeing anything, used on garbage once the
+// references to live objects have been released
+static void clear_children(void *obj) {
+    if (is_env(obj)) {
+        Env *env = obj;
+
+        env->parent = NULL;
+        for (int i = 0; i < env->size; i++) {
+            env->slots[i].value = NULL;
+        }
+        for (EnvElem *elem = env->first; elem != NULL; elem = elem->next) {
+            elem->value = NULL;
+        }
+        for (unsigned i = 0; env->table && i < env->table->size; i++) {
+            if (env->table->slots[i]) env->table->slots[i]->value = NULL;
+        }
+        return;
+    }
+
+    Value *v = obj;
+    switch (v->type) {
+    case TYPE_LIST:
+        CAR(v) = NULL;
+        CDR(v) = NULL;
+        break;
+    case TYPE_FUNCTION:
+    case TYPE_FUNCTION_SF:
+    case TYPE_MACRO:
+        v->value.func.operands = NULL;
+        v->value.func.body = NULL;
+        v->value.func.env = NULL;
+        break;
+    case TYPE_VECTOR:
+        for (size_t i = 0; i < v->value.vector.len; i++) {
+            v->value.vector.items[i] = NULL;
+        }
+        break;
+    case TYPE_HASHTABLE:
+        hashtable_each(v->value.hashtable, clear_entry, NULL);
+        break;
+    default:
+        break;
+    }
+}
+
+static void init_refs(void *obj) {
+    if (!is_env(obj) && ((Value *)obj)->type == TYPE_ATOM) return;
+
+    int refs = is_env(obj) ? ((Env *)obj)->refs : ((Value *)obj)->refs;
+    *gc_word(obj) = GC_CANDIDATE | (refs & GC_COUNT);
+}
+
+static void subtract_ref(void *child) {
+    if (is_candidate(child)) *gc_word(child) -= 1;
+}
+
+static void subtract_internal_refs(void *obj) {
+    if (is_candidate(obj)) each_child(obj, subtract_ref);
+}
+
+static void mark_child(void *child) {
+    if (is_candidate(child) && !(*gc_word(child) & GC_MARK)) {
+        *gc_word(child) |= GC_MARK;
+        push(&stack, child);
+    }
+}
+
+static void mark_roots(void *obj) {
+    unsigned *word = gc_word(obj);
+    if (!is_candidate(obj) || (*word & GC_MARK) || !(*word & GC_COUNT)) return;
+
+    *word |= GC_MARK;
+    push(&stack, obj);
+
+    while (stack.count > 0) {
+        each_child(stack.items[--stack.count], mark_child);
+    }
+}
+
+static void sweep(void *obj) {
+    if (!is_candidate(obj)) return;
+
+    if (*gc_word(obj) & GC_MARK) {
+        *gc_word(obj) = 0;
+    } else {
+        push(&garbage, obj);
+    }
+}
+
+static void release_live_child(void *child) {
+    if (is_candidate(child) && !(*gc_word(child) & GC_MARK)) return;
+
+    if (is_env(child)) {
+        delete_env(child);
+    } else {
+        delete_value(child);
+    }
+}
+
+static size_t collect(void (*each)(void (*fn)(void *cell))) {
+    each(init_refs);
+    each(subtract_internal_refs);
+    each(mark_roots);
+    each(sweep);
+
+    size_t freed = garbage.count;
+
+    // The garbage may still hold references to live objects, drop those first
+    for (size_t i = 0; i < garbage.count; i++) {
+        each_child(garbage.items[i], release_live_child);
+        clear_children(garbage.items[i]);
+    }
+
+    // With nothing left to follow, freeing each object frees only itself
+    for (size_t i = 0; i < garbage.count; i++) {
+        void *obj = garbage.items[i];
+
+        if (is_env(obj)) {
+            ((Env *)obj)->refs = 1;
+            delete_env(obj);
+        } else {
+            ((Value *)obj)->refs = 1;
+            delete_value(obj);
+        }
+    }
+    garbage.count = 0;
+
+    slab_promote();
+    gc_young_threshold = slab_young + GC_NURSERY_SIZE;
+    return freed;
+}
+
+size_t gc_collect(void) {
+    size_t freed = collect(slab_each);
+
+    gc_threshold = slab_live * 2 > GC_MIN_HEAP ? slab_live * 2 : GC_MIN_HEAP;
+    return freed;
+}
+
+size_t gc_collect_young(void) {
+    return collect(slab_each_young);
+}
@@ -0,0 +1,33 @@
+#ifndef GC_H
+#define GC_H
+
+#include <stddef.h>
+#include "alloc.h"
+
+// Values and environments are reference counted, which frees most garbage as
+// soon as it is dropped. The collector reclaims what refcounting can't:
+// cycles, such as a closure stored in the environment it captured.
+
+// Collect everything when the heap has grown to this many objects
+#ifndef GC_MIN_HEAP
+#define GC_MIN_HEAP 100000
+#endif
+
+// Collect the nursery when this many more objects have survived in it
+#ifndef GC_NURSERY_SIZE
+#define GC_NURSERY_SIZE 32768
+#endif
+
+extern size_t gc_threshold;
+extern size_t gc_young_threshold;
+
+// Both return the number of objects freed
+size_t gc_collect(void);
+size_t gc_collect_young(void);
+
+static inline void gc_maybe_collect(void) {
+    if (slab_live >= gc_threshold) gc_collect();
+    else if (slab_young >= gc_young_threshold) gc_collect_young();
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// FNV-1a
+static inline unsigned hash_bytes(const char *s, size_t len) {
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static inline unsigned hash_ptr(const void *p) {
+    return (unsigned)((uintptr_t)p >> 4) * 2654435769u;
+}
+
+// Index into a table of 2^bits entries, used by the perfect hash of builtins
+static inline unsigned hash_index(unsigned h, unsigned seed, int bits) {
+    return ((h ^ seed) * 2654435769u) >> (32 - bits);
+}
+
+#endif
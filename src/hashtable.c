@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "hashtable.h"
+
+#define ENTRY_EMPTY   0
+#define ENTRY_FULL    1
+#define ENTRY_DELETED 2
+
+#define MIN_SIZE 8
+
+// Old entries moved to the new array by every change during a resize. The
+// new array is at least four times as big as the live entries, so it takes
+// as many insertions again to get it half full and grow it, by which time
+// the move is long done.
+#define MOVE_STEP 16
+
+// Bounds on how much of a list or vector key is hashed
+#define HASH_DEPTH 4
+#define HASH_ITEMS 16
+
+static unsigned hash_number(Number n) {
+    // Equal numbers must hash the same whatever their representation
+    double d = number_to_double(n);
+    if (d == 0) d = 0; // -0.0
+    return hash_bytes((const char *)&d, sizeof d);
+}
+
+static unsigned hash_depth(Value *v, int depth) {
+    unsigned h;
+
+    switch (TYPEOF(v)) {
+    case TYPE_NUMBER:
+        return hash_number(number_of(v));
+    case TYPE_STRING:
+        return hash_bytes(string_chars(v), string_len(v));
+    case TYPE_BYTEVECTOR:
+        return TYPE_BYTEVECTOR ^ hash_bytes((const char *)bytevector_data(v), bytevector_len(v));
+    case TYPE_EXCEPTION:
+    case TYPE_BOUND_EXCEPTION:
+        return hash_bytes(v->value.exception, strlen(v->value.exception));
+    case TYPE_BUILTIN:
+    case TYPE_BUILTIN_SF:
+        return hash_ptr((void *)v->value.builtin);
+    case TYPE_FUNCTION:
+    case TYPE_FUNCTION_SF:
+    case TYPE_MACRO:
+        return TYPE_FUNCTION; // compared by their code, not worth hashing
+    case TYPE_LIST:
+        h = TYPE_LIST;
+        if (depth == 0) return h;
+        for (int i = 0; i < HASH_ITEMS && TYPEOF(v) == TYPE_LIST; i++, v = CDR(v)) {
+            h = (h ^ hash_depth(CAR(v), depth - 1)) * 16777619u;
+        }
+        // A dotted pair ends in something other than ()
+        return v == NULL || TYPEOF(v) == TYPE_LIST ? h : (h ^ hash_depth(v, depth - 1)) * 16777619u;
+    case TYPE_F64VECTOR:
+    case TYPE_S64VECTOR:
+        h = v->type + v->value.numvector.len;
+        for (size_t i = 0; i < v->value.numvector.len && i < HASH_ITEMS; i++) {
+            Number n = v->type == TYPE_F64VECTOR
+                ? create_number_d(v->value.numvector.f64[i])
+                : create_number_ll(v->value.numvector.s64[i]);
+            h = (h ^ hash_number(n)) * 16777619u;
+        }
+        return h;
+    case TYPE_VECTOR:
+        h = TYPE_VECTOR + v->value.vector.len;
+        if (depth == 0) return h;
+        for (size_t i = 0; i < v->value.vector.len && i < HASH_ITEMS; i++) {
+            h = (h ^ hash_depth(v->value.vector.items[i], depth - 1)) * 16777619u;
+        }
+        return h;
+    default:
+        // Atoms, immediates and (): equal only if identical
+        return hash_ptr(v);
+    }
+}
+
+unsigned hash_value(Value *v) {
+    return hash_depth(v, HASH_DEPTH);
+}
+
+static unsigned hash_key(struct HashTable *table, Value *key) {
+    if (table->kind == HASH_EQ) return hash_ptr(key);
+    return hash_value(key);
+}
+
+static int keys_equal(struct HashTable *table, Value *a, Value *b) {
+    switch (table->kind) {
+    case HASH_EQ:
+        return a == b;
+    case HASH_STRING:
+        return a == b || values_equal(a, b);
+    default:
+        return values_equal(a, b);
+    }
+}
+
+Value *create_hashtable(enum HashKind kind) {
+    struct HashTable *table = calloc(1, sizeof *table);
+    table->kind = kind;
+
+    Value *v = create_value(TYPE_HASHTABLE);
+    v->value.hashtable = table;
+    return v;
+}
+
+void free_hashtable(struct HashTable *table) {
+    for (size_t i = 0; i < table->size; i++) {
+        if (table->entries[i].state != ENTRY_FULL) continue;
+        delete_value(table->entries[i].key);
+        delete_value(table->entries[i].value);
+    }
+    for (size_t i = 0; i < table->old_size; i++) {
+        if (table->old[i].state != ENTRY_FULL) continue;
+        delete_value(table->old[i].key);
+        delete_value(table->old[i].value);
+    }
+    free(table->entries);
+    free(table->old);
+    free(table);
+}
+
+static HashEntry *probe(HashEntry *entries, size_t size, struct HashTable *table, Value *key, unsigned hash) {
+    if (size == 0) return NULL;
+
+    for (size_t i = hash & (size - 1);; i = (i + 1) & (size - 1)) {
+        HashEntry *e = &entries[i];
+        if (e->state == ENTRY_EMPTY) return NULL;
+        if (e->state == ENTRY_FULL && e->hash == hash && keys_equal(table, e->key, key)) return e;
+    }
+}
+
+static HashEntry *lookup(struct HashTable *table, Value *key, unsigned hash) {
+    HashEntry *e = probe(table->entries, table->size, table, key, hash);
+    if (e == NULL && table->old) e = probe(table->old, table->old_size, table, key, hash);
+    return e;
+}
+
+// A free entry for hash in the new array, which is never full
+static HashEntry *free_entry(struct HashTable *table, unsigned hash) {
+    size_t i = hash & (table->size - 1);
+    while (table->entries[i].state == ENTRY_FULL) i = (i + 1) & (table->size - 1);
+    return &table->entries[i];
+}
+
+static void place(struct HashTable *table, Value *key, Value *value, unsigned hash) {
+    HashEntry *e = free_entry(table, hash);
+    if (e->state == ENTRY_EMPTY) table->used++;
+    *e = (HashEntry){ key, value, hash, ENTRY_FULL };
+}
+
+// Moves up to n entries of the old array. Moved entries are marked deleted
+// rather than empty so the probe sequences through them still work.
+static void move_old(struct HashTable *table, size_t n) {
+    while (table->old && n > 0) {
+        if (table->moved == table->old_size) {
+            free(table->old);
+            table->old = NULL;
+            table->old_size = table->moved = 0;
+            break;
+        }
+
+        HashEntry *e = &table->old[table->moved++];
+        if (e->state != ENTRY_FULL) continue;
+        place(table, e->key, e->value, e->hash);
+        e->state = ENTRY_DELETED;
+        n--;
+    }
+}
+
+static void grow(struct HashTable *table) {
+    // Finish the last resize first, there is only room for one old array
+    move_old(table, SIZE_MAX);
+
+    size_t size = MIN_SIZE;
+    while (size < table->count * 4) size <<= 1;
+
+    table->old = table->entries;
+    table->old_size = table->size;
+    table->moved = 0;
+
+    table->entries = calloc(size, sizeof *table->entries);
+    table->size = size;
+    table->used = 0;
+}
+
+Value **hashtable_find(struct HashTable *table, Value *key) {
+    HashEntry *e = lookup(table, key, hash_key(table, key));
+    return e ? &e->value : NULL;
+}
+
+void hashtable_set(struct HashTable *table, Value *key, Value *value) {
+    unsigned hash = hash_key(table, key);
+    HashEntry *e = lookup(table, key, hash);
+
+    if (e != NULL) {
+        delete_value(e->key);
+        delete_value(e->value);
+        e->key = key;
+        e->value = value;
+        return;
+    }
+
+    if ((table->used + 1) * 2 > table->size) grow(table);
+    place(table, key, value, hash);
+    table->count++;
+    move_old(table, MOVE_STEP);
+}
+
+int hashtable_delete(struct HashTable *table, Value *key) {
+    HashEntry *e = lookup(table, key, hash_key(table, key));
+    if (e == NULL) return 0;
+
+    delete_value(e->key);
+    delete_value(e->value);
+    e->key = e->value = NULL;
+    e->state = ENTRY_DELETED;
+    table->count--;
+    move_old(table, MOVE_STEP);
+    return 1;
+}
+
+void hashtable_each(struct HashTable *table, void (*fn)(HashEntry *entry, void *data), void *data) {
+    for (size_t i = 0; i < table->size; i++) {
+        if (table->entries[i].state == ENTRY_FULL) fn(&table->entries[i], data);
+    }
+    for (size_t i = table->moved; i < table->old_size; i++) {
+        if (table->old[i].state == ENTRY_FULL) fn(&table->old[i], data);
+    }
+}
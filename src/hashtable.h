@@ -0,0 +1,52 @@
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+
+#include "value.h"
+
+// Hash tables made by make-hash-table. Open addressing with linear probing;
+// when the table grows, the entries move to the new array a few at a time
+// with each change, so no single insertion pays for rehashing everything.
+
+enum HashKind {
+    HASH_EQ,     // keys are the same object
+    HASH_EQUAL,  // keys are values_equal()
+    HASH_STRING, // keys are strings with the same text
+};
+
+typedef struct {
+    Value *key, *value;
+    unsigned hash;
+    int state; // ENTRY_EMPTY, ENTRY_FULL or ENTRY_DELETED, see hashtable.c
+} HashEntry;
+
+struct HashTable {
+    enum HashKind kind;
+    size_t count;
+
+    HashEntry *entries;
+    size_t size, used; // used counts deleted entries too
+
+    // The array before the last growth, while its entries are being moved
+    HashEntry *old;
+    size_t old_size, moved;
+};
+
+Value *create_hashtable(enum HashKind kind);
+void free_hashtable(struct HashTable *table);
+
+// The value stored for key, NULL if there is none
+Value **hashtable_find(struct HashTable *table, Value *key);
+
+// Takes over the references to key and value
+void hashtable_set(struct HashTable *table, Value *key, Value *value);
+
+// Returns 0 if key wasn't in the table
+int hashtable_delete(struct HashTable *table, Value *key);
+
+// Calls fn on every entry. fn must not change the table.
+void hashtable_each(struct HashTable *table, void (*fn)(HashEntry *entry, void *data), void *data);
+
+// Consistent with values_equal()
+unsigned hash_value(Value *v);
+
+#endif
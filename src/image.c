@@ -0,0 +1,760 @@
+#include <stdlib.h>
+#include <string.h>
+#include "alloc.h"
+#include "builtins.h"
+#include "env.h"
+#include "expand.h"
+#include "hash.h"
+#include "hashtable.h"
+#include "image.h"
+#include "symbol.h"
+
+// The file starts with a header, followed by one record per object. Object 1
+// is the global environment. Each record is the object's type as a byte, then:
+//
+//   atom              local flag (u8), length (u32), name
+//   number            number type (u8), value (u64); for a bigint the value
+//                     is its limb count << 1 | sign, and the limbs (u32)
+//                     follow
+//   string/exception  length (u32), text
+//   list              car, cdr, ref_depth (u16), ref_slot (u16)
+//   function/macro    operands, body, env, nslots (u32)
+//   builtin           index into builtin_values (u32)
+//   vector            length (u64), items
+//   hash table        kind (u8), count (u64), count keys and values
+//   f64/s64vector     length (u64), items (8 bytes each)
+//   environment       parent, size (u32), size slots, count (u32), count
+//                     bindings created by define; the global environment
+//                     has its table in the latter
+//
+// Hash tables are filled in once everything else is, since the hashes of
+// their keys depend on the keys' contents.
+//
+// A slot or binding is two references, name and value. A reference is a u64:
+// 0 for NULL, the Value pointer itself for an immediate, or the object's
+// number shifted left by 2 (so its low bits are clear like a heap pointer's).
+// Numbers are in the byte order of the machine that wrote them.
+
+#define IMAGE_MAGIC "FSIMAGE"
+#define IMAGE_VERSION 5
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t builtin_count; // must match, builtins are saved by index
+    uint64_t count;         // of objects
+} Header;
+
+static int is_env(void *obj) {
+    return *(enum Type *)obj == TYPE_ENV;
+}
+
+// Dumping
+
+// Numbers the objects in the order they are found
+typedef struct {
+    void **objects;
+    size_t count, size;
+
+    // Open addressing from object to its number
+    void **keys;
+    uint64_t *numbers;
+    size_t table_size;
+} Objects;
+
+static uint64_t *find_number(Objects *o, void *obj) {
+    size_t mask = o->table_size - 1;
+    size_t i = hash_ptr(obj) & mask;
+
+    while (o->keys[i] != NULL && o->keys[i] != obj) i = (i + 1) & mask;
+    o->keys[i] = obj;
+    return &o->numbers[i];
+}
+
+static void grow_objects(Objects *o) {
+    free(o->keys);
+    free(o->numbers);
+
+    o->table_size = o->table_size ? o->table_size * 2 : 1024;
+    o->keys = calloc(o->table_size, sizeof *o->keys);
+    o->numbers = calloc(o->table_size, sizeof *o->numbers);
+
+    for (size_t i = 0; i < o->count; i++) {
+        *find_number(o, o->objects[i]) = i + 1;
+    }
+}
+
+static void visit(Objects *o, void *obj) {
+    if (!IS_HEAP((Value *)obj)) return;
+
+    if ((o->count + 1) * 2 > o->table_size) grow_objects(o);
+
+    uint64_t *number = find_number(o, obj);
+    if (*number) return;
+
+    if (o->count == o->size) {
+        o->size = o->size ? o->size * 2 : 1024;
+        o->objects = realloc(o->objects, o->size * sizeof *o->objects);
+    }
+    o->objects[o->count++] = obj;
+    *number = o->count;
+}
+
+static void visit_entry(HashEntry *e, void *data) {
+    visit(data, e->key);
+    visit(data, e->value);
+}
+
+static void visit_children(Objects *o, void *obj) {
+    if (is_env(obj)) {
+        Env *env = obj;
+
+        visit(o, env->parent);
+        for (int i = 0; i < env->size; i++) {
+            visit(o, env->slots[i].name);
+            visit(o, env->slots[i].value);
+        }
+        for (EnvElem *elem = env->first; elem != NULL; elem = elem->next) {
+            visit(o, elem->name);
+            visit(o, elem->value);
+        }
+        for (unsigned i = 0; env->table && i < env->table->size; i++) {
+            if (env->table->slots[i]) {
+                visit(o, env->table->slots[i]->name);
+                visit(o, env->table->slots[i]->value);
+            }
+        }
+        return;
+    }
+
+    Value *v = obj;
+    switch (v->type) {
+    case TYPE_LIST:
+        visit(o, CAR(v));
+        visit(o, CDR(v));
+        break;
+    case TYPE_FUNCTION:
+    case TYPE_FUNCTION_SF:
+    case TYPE_MACRO:
+        visit(o, v->value.func.operands);
+        visit(o, v->value.func.body);
+        visit(o, v->value.func.env);
+        break;
+    case TYPE_VECTOR:
+        for (size_t i = 0; i < v->value.vector.len; i++) {
+            visit(o, v->value.vector.items[i]);
+        }
+        break;
+    case TYPE_HASHTABLE:
+        hashtable_each(v->value.hashtable, visit_entry, o);
+        break;
+    default:
+        break;
+    }
+}
+
+static void put(FILE *f, const void *data, size_t size) {
+    fwrite(data, size, 1, f);
+}
+
+static void put_u8(FILE *f, uint8_t x) { put(f, &x, sizeof x); }
+static void put_u16(FILE *f, uint16_t x) { put(f, &x, sizeof x); }
+static void put_u32(FILE *f, uint32_t x) { put(f, &x, sizeof x); }
+static void put_u64(FILE *f, uint64_t x) { put(f, &x, sizeof x); }
+
+static void put_ref(FILE *f, Objects *o, void *obj) {
+    if (obj == NULL) {
+        put_u64(f, 0);
+    } else if (!IS_HEAP((Value *)obj)) {
+        put_u64(f, (uintptr_t)obj);
+    } else {
+        put_u64(f, *find_number(o, obj) << 2);
+    }
+}
+
+static void put_text(FILE *f, const char *text) {
+    uint32_t len = strlen(text);
+    put_u32(f, len);
+    put(f, text, len);
+}
+
+typedef struct {
+    FILE *f;
+    Objects *o;
+} Output;
+
+static void put_entry(HashEntry *e, void *data) {
+    Output *out = data;
+    put_ref(out->f, out->o, e->key);
+    put_ref(out->f, out->o, e->value);
+}
+
+static int builtin_index(Value *v) {
+    for (int i = 0; i < builtin_count; i++) {
+        Value *b = builtin_values[i];
+        if (b == v || (IS_HEAP(b) && b->type == v->type && b->value.builtin == v->value.builtin)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void put_env(FILE *f, Objects *o, Env *env) {
+    uint32_t count = 0;
+
+    put_u8(f, TYPE_ENV);
+    put_ref(f, o, env->parent);
+
+    put_u32(f, env->size);
+    for (int i = 0; i < env->size; i++) {
+        put_ref(f, o, env->slots[i].name);
+        put_ref(f, o, env->slots[i].value);
+    }
+
+    for (EnvElem *elem = env->first; elem != NULL; elem = elem->next) count++;
+    if (env->table) count += env->table->count;
+
+    put_u32(f, count);
+    for (EnvElem *elem = env->first; elem != NULL; elem = elem->next) {
+        put_ref(f, o, elem->name);
+        put_ref(f, o, elem->value);
+    }
+    for (unsigned i = 0; env->table && i < env->table->size; i++) {
+        if (env->table->slots[i]) {
+            put_ref(f, o, env->table->slots[i]->name);
+            put_ref(f, o, env->table->slots[i]->value);
+        }
+    }
+}
+
+// Returns 0 if v can't be saved
+static int put_value(FILE *f, Objects *o, Value *v) {
+    put_u8(f, v->type);
+
+    switch (v->type) {
+    case TYPE_ATOM:
+        put_u8(f, v->local);
+        put_text(f, v->value.atom);
+        break;
+    case TYPE_NUMBER:
+        put_u8(f, v->value.number.type);
+        if (v->value.number.type == NUMBER_BIGINT) {
+            BigInt *big = v->value.number.v.big;
+            put_u64(f, (uint64_t)big->len << 1 | big->neg);
+            put(f, big->limbs, big->len * sizeof big->limbs[0]);
+        } else {
+            put(f, &v->value.number.v, sizeof(uint64_t));
+        }
+        break;
+    case TYPE_STRING:
+        put_u32(f, string_len(v));
+        put(f, string_chars(v), string_len(v));
+        break;
+    case TYPE_EXCEPTION:
+    case TYPE_BOUND_EXCEPTION:
+        put_text(f, v->value.exception);
+        break;
+    case TYPE_LIST:
+        put_ref(f, o, CAR(v));
+        put_ref(f, o, CDR(v));
+        put_u16(f, v->ref_depth);
+        put_u16(f, v->ref_slot);
+        break;
+    case TYPE_FUNCTION:
+    case TYPE_FUNCTION_SF:
+    case TYPE_MACRO:
+        put_ref(f, o, v->value.func.operands);
+        put_ref(f, o, v->value.func.body);
+        put_ref(f, o, v->value.func.env);
+        put_u32(f, v->nslots);
+        break;
+    case TYPE_BUILTIN:
+    case TYPE_BUILTIN_SF: {
+        int i = builtin_index(v);
+        if (i < 0) return 0;
+        put_u32(f, i);
+        break;
+    }
+    case TYPE_VECTOR:
+        put_u64(f, v->value.vector.len);
+        for (size_t i = 0; i < v->value.vector.len; i++) {
+            put_ref(f, o, v->value.vector.items[i]);
+        }
+        break;
+    case TYPE_HASHTABLE:
+        put_u8(f, v->value.hashtable->kind);
+        put_u64(f, v->value.hashtable->count);
+        hashtable_each(v->value.hashtable, put_entry, &(Output){ f, o });
+        break;
+    case TYPE_F64VECTOR:
+    case TYPE_S64VECTOR:
+        put_u64(f, v->value.numvector.len);
+        put(f, v->value.numvector.f64, v->value.numvector.len * sizeof(double));
+        break;
+    case TYPE_BYTEVECTOR:
+        put_u64(f, bytevector_len(v));
+        put(f, bytevector_data(v), bytevector_len(v));
+        break;
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+Value *dump_image(const char *path, Env *env) {
+    Objects o = { 0 };
+    Value *error = NULL;
+
+    visit(&o, env);
+    for (size_t i = 0; i < o.count; i++) visit_children(&o, o.objects[i]);
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        error = create_exception("Cannot open file '%s'.", path);
+        goto done;
+    }
+
+    Header header = { IMAGE_MAGIC, IMAGE_VERSION, builtin_count, o.count };
+    put(f, &header, sizeof header);
+
+    for (size_t i = 0; i < o.count && !error; i++) {
+        if (is_env(o.objects[i])) {
+            put_env(f, &o, o.objects[i]);
+        } else if (!put_value(f, &o, o.objects[i])) {
+            error = create_exception("Cannot save a %s in an image.",
+                    type_names[((Value *)o.objects[i])->type]);
+        }
+    }
+
+    if ((ferror(f) | fclose(f)) && !error) {
+        error = create_exception("Cannot write image '%s'.", path);
+    }
+    if (error) remove(path);
+
+done:
+    free(o.objects);
+    free(o.keys);
+    free(o.numbers);
+    return error;
+}
+
+// Loading
+
+typedef struct {
+    const unsigned char *p, *end;
+    int bad; // set on reading past the end or anything invalid
+
+    void **objects;
+    uint64_t count;
+
+    // (table vector-of-keys-and-values) for each hash table, see
+    // fill_tables()
+    Value *tables;
+} Input;
+
+static void get(Input *in, void *dst, size_t size) {
+    if ((size_t)(in->end - in->p) < size) {
+        in->bad = 1;
+        memset(dst, 0, size);
+        return;
+    }
+    memcpy(dst, in->p, size);
+    in->p += size;
+}
+
+static uint8_t get_u8(Input *in) { uint8_t x; get(in, &x, sizeof x); return x; }
+static uint16_t get_u16(Input *in) { uint16_t x; get(in, &x, sizeof x); return x; }
+static uint32_t get_u32(Input *in) { uint32_t x; get(in, &x, sizeof x); return x; }
+static uint64_t get_u64(Input *in) { uint64_t x; get(in, &x, sizeof x); return x; }
+
+// Returns the text of length len in place, not NUL terminated
+static const char *get_text(Input *in, uint32_t *len) {
+    *len = get_u32(in);
+    if ((size_t)(in->end - in->p) < *len) {
+        in->bad = 1;
+        *len = 0;
+        return "";
+    }
+    const char *text = (const char *)in->p;
+    in->p += *len;
+    return text;
+}
+
+// The object a reference in a record is to, NULL if it isn't one
+static void *get_object(Input *in) {
+    uint64_t word = get_u64(in);
+    if (word & 3) {
+        in->bad = 1;
+        return NULL;
+    }
+
+    uint64_t number = word >> 2;
+    if (number == 0) return NULL;
+    if (number > in->count) {
+        in->bad = 1;
+        return NULL;
+    }
+    return in->objects[number - 1];
+}
+
+// A reference to a Value, counted
+static Value *get_value(Input *in) {
+    const unsigned char *at = in->p;
+    uint64_t word = get_u64(in);
+    if (word & 3) return (Value *)(uintptr_t)word;
+
+    in->p = at;
+    void *obj = get_object(in);
+    if (obj != NULL && is_env(obj)) {
+        in->bad = 1;
+        return NULL;
+    }
+    return copy_value(obj);
+}
+
+// A reference to an environment, counted
+static Env *get_env(Input *in) {
+    void *obj = get_object(in);
+    if (obj != NULL && !is_env(obj)) {
+        in->bad = 1;
+        return NULL;
+    }
+    return obj ? copy_env(obj) : NULL;
+}
+
+// First pass: creates the object of the record at in->p, empty, and skips
+// the rest of the record
+static void *create_object(Input *in, int global) {
+    enum Type type = get_u8(in);
+    uint32_t len;
+    const char *text;
+
+    switch (type) {
+    case TYPE_ATOM:
+        get_u8(in);
+        text = get_text(in, &len);
+        return intern_n(text, len);
+    case TYPE_NUMBER: {
+        uint8_t number_type = get_u8(in);
+        uint64_t word = get_u64(in);
+        if (number_type == NUMBER_BIGINT) {
+            if (word >> 1 > (uint64_t)(in->end - in->p) / sizeof(uint32_t)) {
+                in->bad = 1;
+                return NULL;
+            }
+            in->p += (word >> 1) * sizeof(uint32_t);
+        } else if (number_type > NUMBER_BIGINT) {
+            in->bad = 1;
+        }
+        break;
+    }
+    case TYPE_STRING:
+        // Strings are made whole here, their bytes are skipped when filled in
+        text = get_text(in, &len);
+        if (in->bad) return NULL;
+        return create_string_len(text, len);
+    case TYPE_EXCEPTION:
+    case TYPE_BOUND_EXCEPTION:
+        get_text(in, &len);
+        break;
+    case TYPE_LIST:
+        get_u64(in);
+        get_u64(in);
+        get_u32(in);
+        break;
+    case TYPE_FUNCTION:
+    case TYPE_FUNCTION_SF:
+    case TYPE_MACRO:
+        get_u64(in);
+        get_u64(in);
+        get_u64(in);
+        get_u32(in);
+        break;
+    case TYPE_BUILTIN:
+    case TYPE_BUILTIN_SF: {
+        uint32_t i = get_u32(in);
+        if (i >= (uint32_t)builtin_count || !IS_HEAP(builtin_values[i])) {
+            in->bad = 1;
+            return NULL;
+        }
+        return copy_value(builtin_values[i]);
+    }
+    case TYPE_VECTOR: {
+        uint64_t len = get_u64(in);
+        if ((uint64_t)(in->end - in->p) / sizeof(uint64_t) < len) {
+            in->bad = 1;
+            return NULL;
+        }
+        in->p += len * sizeof(uint64_t);
+        return create_vector(len, NULL);
+    }
+    case TYPE_HASHTABLE: {
+        uint8_t kind = get_u8(in);
+        uint64_t count = get_u64(in);
+        if (kind > HASH_STRING || (uint64_t)(in->end - in->p) / (2 * sizeof(uint64_t)) < count) {
+            in->bad = 1;
+            return NULL;
+        }
+        in->p += count * 2 * sizeof(uint64_t);
+        return create_hashtable(kind);
+    }
+    case TYPE_F64VECTOR:
+    case TYPE_S64VECTOR: {
+        uint64_t len = get_u64(in);
+        if ((uint64_t)(in->end - in->p) / sizeof(double) < len) {
+            in->bad = 1;
+            return NULL;
+        }
+        in->p += len * sizeof(double);
+        return create_numvector(type, len);
+    }
+    case TYPE_BYTEVECTOR: {
+        uint64_t len = get_u64(in);
+        if ((uint64_t)(in->end - in->p) < len) {
+            in->bad = 1;
+            return NULL;
+        }
+        in->p += len;
+        return create_bytevector(len);
+    }
+    case TYPE_ENV: {
+        get_u64(in);
+        uint32_t size = get_u32(in);
+        if ((size_t)(in->end - in->p) / (2 * sizeof(uint64_t)) < size) {
+            in->bad = 1;
+            return NULL;
+        }
+        in->p += size * 2 * sizeof(uint64_t);
+
+        uint32_t count = get_u32(in);
+        if ((size_t)(in->end - in->p) / (2 * sizeof(uint64_t)) < count) {
+            in->bad = 1;
+            return NULL;
+        }
+        in->p += count * 2 * sizeof(uint64_t);
+
+        if (global) {
+            if (size != 0) in->bad = 1;
+            return create_global_env();
+        }
+        return create_frame(NULL, size);
+    }
+    default:
+        in->bad = 1;
+        return NULL;
+    }
+
+    if (in->bad) return NULL;
+    return create_value(type);
+}
+
+// Second pass: fills in obj from its record at in->p
+static void fill_object(Input *in, void *obj) {
+    enum Type type = get_u8(in);
+    uint32_t len;
+    const char *text;
+    char *copy;
+
+    if (is_env(obj)) {
+        Env *env = obj;
+
+        env->parent = get_env(in);
+        get_u32(in);
+        for (int i = 0; i < env->size; i++) {
+            env->slots[i].name = get_value(in);
+            env->slots[i].value = get_value(in);
+        }
+
+        uint32_t count = get_u32(in);
+        EnvElem **next = &env->first;
+        for (uint32_t i = 0; i < count && !in->bad; i++) {
+            Value *name = get_value(in);
+            Value *value = get_value(in);
+
+            if (TYPEOF(name) != TYPE_ATOM) {
+                in->bad = 1;
+                delete_value(value);
+            } else if (env->table) {
+                add_to_env(env, name, value);
+            } else {
+                *next = malloc(sizeof **next);
+                (*next)->name = name;
+                (*next)->value = value;
+                (*next)->next = NULL;
+                next = &(*next)->next;
+            }
+        }
+        return;
+    }
+
+    Value *v = obj;
+    switch (type) {
+    case TYPE_ATOM:
+        if (get_u8(in)) declare_local(v);
+        get_text(in, &len);
+        break;
+    case TYPE_NUMBER: {
+        enum Number_Type number_type = get_u8(in);
+        if (number_type != NUMBER_BIGINT) {
+            v->value.number.type = number_type;
+            get(in, &v->value.number.v, sizeof(uint64_t));
+            break;
+        }
+
+        uint64_t word = get_u64(in);
+        BigInt *big = create_bigint(word >> 1, word & 1);
+        get(in, big->limbs, big->len * sizeof big->limbs[0]);
+
+        if (big->len == 0 || big->limbs[big->len - 1] == 0) {
+            in->bad = 1;
+            free_bigint(big);
+        } else {
+            v->value.number = create_number_big(big);
+        }
+        break;
+    }
+    case TYPE_STRING:
+        get_text(in, &len);
+        break;
+    case TYPE_EXCEPTION:
+    case TYPE_BOUND_EXCEPTION:
+        text = get_text(in, &len);
+        copy = malloc(len + 1);
+        memcpy(copy, text, len);
+        copy[len] = 0;
+        v->value.exception = copy;
+        break;
+    case TYPE_LIST:
+        CAR(v) = get_value(in);
+        CDR(v) = get_value(in);
+        v->ref_depth = get_u16(in);
+        v->ref_slot = get_u16(in);
+        if (!IS_LIST(CDR(v))) in->bad = 1;
+        break;
+    case TYPE_FUNCTION:
+    case TYPE_FUNCTION_SF:
+    case TYPE_MACRO:
+        v->value.func.operands = get_value(in);
+        v->value.func.body = get_value(in);
+        v->value.func.env = get_env(in);
+        v->nslots = get_u32(in);
+        if (type == TYPE_MACRO) macro_count += 1;
+        break;
+    case TYPE_BUILTIN:
+    case TYPE_BUILTIN_SF:
+        get_u32(in);
+        break;
+    case TYPE_VECTOR:
+        get_u64(in);
+        for (size_t i = 0; i < v->value.vector.len; i++) {
+            v->value.vector.items[i] = get_value(in);
+        }
+        break;
+    case TYPE_HASHTABLE: {
+        get_u8(in);
+        Value *entries = create_vector(2 * get_u64(in), NULL);
+        for (size_t i = 0; i < entries->value.vector.len; i++) {
+            entries->value.vector.items[i] = get_value(in);
+        }
+        in->tables = cons(cons(copy_value(v), cons(entries, NULL)), in->tables);
+        break;
+    }
+    case TYPE_F64VECTOR:
+    case TYPE_S64VECTOR:
+        get_u64(in);
+        get(in, v->value.numvector.f64, v->value.numvector.len * sizeof(double));
+        break;
+    case TYPE_BYTEVECTOR:
+        get_u64(in);
+        get(in, bytevector_data(v), bytevector_len(v));
+        break;
+    default:
+        in->bad = 1;
+        break;
+    }
+}
+
+// Third pass: puts the entries of the hash tables in them
+static void fill_tables(Input *in) {
+    for (Value *it = in->tables; it != NULL; it = CDR(it)) {
+        struct HashTable *table = CAR(CAR(it))->value.hashtable;
+        struct Vector *entries = &CAR(CDR(CAR(it)))->value.vector;
+
+        for (size_t i = 0; i < entries->len; i += 2) {
+            Value *key = entries->items[i];
+            if (table->kind == HASH_STRING && TYPEOF(key) != TYPE_STRING) {
+                in->bad = 1;
+                return;
+            }
+            hashtable_set(table, copy_value(key), copy_value(entries->items[i + 1]));
+        }
+    }
+}
+
+// Drops the references the loader holds
+static void release_objects(Input *in, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        void *obj = in->objects[i];
+        if (obj == NULL) continue;
+
+        if (is_env(obj)) {
+            delete_env(obj);
+        } else {
+            delete_value(obj);
+        }
+    }
+}
+
+Value *load_image(const char *path, Env **dst) {
+    size_t size;
+    const unsigned char *data = map_file(path, &size);
+    if (data == NULL) return create_exception("Cannot open file '%s'.", path);
+
+    Input in = { data, data + size, 0, NULL, 0, NULL };
+    Header header;
+    get(&in, &header, sizeof header);
+
+    if (in.bad || memcmp(header.magic, IMAGE_MAGIC, sizeof header.magic)
+            || header.version != IMAGE_VERSION
+            || header.builtin_count != (uint32_t)builtin_count) {
+        unmap_file(data, size);
+        return create_exception("'%s' is not an image of this build.", path);
+    }
+
+    // Every record takes more than a byte
+    if (header.count == 0 || header.count > size) in.bad = 1;
+
+    in.count = header.count;
+    in.objects = in.bad ? NULL : calloc(in.count, sizeof *in.objects);
+
+    const unsigned char *records = in.p;
+    uint64_t created = 0;
+    while (!in.bad && created < in.count) {
+        in.objects[created] = create_object(&in, created == 0);
+        if (in.objects[created] == NULL) in.bad = 1;
+        created++;
+    }
+    if (!in.bad && !is_env(in.objects[0])) in.bad = 1;
+
+    in.p = records;
+    for (uint64_t i = 0; i < in.count && !in.bad; i++) {
+        fill_object(&in, in.objects[i]);
+    }
+    if (!in.bad) fill_tables(&in);
+    delete_value(in.tables);
+
+    unmap_file(data, size);
+
+    if (in.bad) {
+        release_objects(&in, created);
+        free(in.objects);
+        return create_exception("Image '%s' is damaged.", path);
+    }
+
+    // The global environment keeps the loader's reference
+    *dst = in.objects[0];
+    in.objects[0] = NULL;
+    release_objects(&in, in.count);
+    free(in.objects);
+    return NULL;
+}
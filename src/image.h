@@ -0,0 +1,22 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "value.h"
+
+// A heap image is a snapshot of a global environment and every value it
+// reaches, closures and their environments included, so a later process can
+// start from it instead of evaluating the standard library again.
+//
+// Objects are numbered and refer to each other by number, atoms by name and
+// builtins by their index in builtins.def, so an image can be loaded anywhere
+// but only by the same build. Compiled code is not saved, it is compiled
+// again when first needed.
+
+// Writes env, a global environment, to path. Returns NULL or an exception.
+Value *dump_image(const char *path, Env *env);
+
+// Reads the global environment saved at path into *dst. Returns NULL or an
+// exception.
+Value *load_image(const char *path, Env **dst);
+
+#endif
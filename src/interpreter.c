@@ -3,10 +3,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include "alloc.h"
 #include "value.h"
 #include "env.h"
 #include "builtins.h"
+#include "expand.h"
+#include "fasl.h"
+#include "image.h"
+#include "scan.h"
+#include "symbol.h"
 #include "interpreter.h"
+#include "vm.h"
+
+#ifdef __unix__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifdef USE_READLINE
 #include <readline/readline.h>
@@ -21,51 +34,221 @@
 
 static Env *global_env;
 
-static Value *parse_value(const char **ptext);
+// Run top-level forms and eval on the bytecode VM, set by -b
+static int use_vm = 0;
+
+// Load scripts from FASL files and write them, set by -c
+static int use_fasl = 0;
+
 Value *eval(Value *v, Env *env);
 
-static int is_comment(const char *text) {
-    return text[0] == ';';
+// Source text being parsed. Regular files are mapped and parsed in place,
+// other files are read through a buffer that is refilled as the parser goes,
+// so only the token being read has to fit in it. For read, the buffer is
+// that of an input port.
+typedef struct {
+    FILE *file;  // NULL for a string or a mapped file
+    Port *port;  // NULL unless parsing for read
+    char *buf;   // text up to len, NUL terminated unless mapped
+    size_t pos, len, size;
+    size_t keep; // refills keep the text from here on, NO_KEEP if none
+
+    int mapped;
+    size_t released; // pages of the mapping before this have been dropped
+} Reader;
+
+#define NO_KEEP ((size_t)-1)
+
+#ifndef READ_BUFFER_SIZE
+#define READ_BUFFER_SIZE 65536
+#endif
+
+static void open_file_reader(Reader *r, FILE *file) {
+    r->file = file;
+    r->port = NULL;
+    r->size = READ_BUFFER_SIZE;
+    r->buf = malloc(r->size);
+    r->buf[0] = 0;
+    r->pos = r->len = 0;
+    r->keep = NO_KEEP;
+    r->mapped = 0;
 }
 
-static void ignore_whitespace(const char **ptext) {
-    while (isspace(**ptext) || is_comment(*ptext)) {
-        if (is_comment(*ptext)) {
-            while (**ptext != '\n' && **ptext != 0) ++*ptext;
-        }
+static void open_string_reader(Reader *r, const char *text) {
+    r->file = NULL;
+    r->port = NULL;
+    r->buf = (char *)text; // only files are written to the buffer
+    r->pos = 0;
+    r->len = r->size = strlen(text);
+    r->keep = NO_KEEP;
+    r->mapped = 0;
+}
+
+// Maps file if it is a regular one, returns 0 if not
+static int open_mapped_reader(Reader *r, FILE *file) {
+#ifdef __unix__
+    struct stat st;
+    int fd = fileno(file);
+
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) return 0;
+
+    char *text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text == MAP_FAILED) return 0;
+    madvise(text, st.st_size, MADV_SEQUENTIAL);
+
+    r->file = NULL;
+    r->port = NULL;
+    r->buf = text;
+    r->pos = 0;
+    r->len = r->size = st.st_size;
+    r->keep = NO_KEEP;
+    r->mapped = 1;
+    r->released = 0;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+#define RELEASE_BYTES (1 << 20)
+
+// Drops the pages of a mapped file that have been parsed, so they don't
+// add up in the process' memory as the file is read
+static void release_parsed(Reader *r) {
+#ifdef __unix__
+    if (!r->mapped || r->pos - r->released < RELEASE_BYTES) return;
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t end = r->pos & ~(page - 1);
+    madvise(r->buf + r->released, end - r->released, MADV_DONTNEED);
+    r->released = end;
+#endif
+}
+
+static void close_reader(Reader *r) {
+#ifdef __unix__
+    if (r->mapped) munmap(r->buf, r->len);
+#endif
+    if (r->file != NULL) free(r->buf);
+}
+
+// Reads more of the file, dropping what has been parsed. Returns 0 at its
+// end.
+static int refill(Reader *r) {
+    if (r->file == NULL && (r->port == NULL || r->port->flags & PORT_STRING)) return 0;
+
+    size_t from = r->keep < r->pos ? r->keep : r->pos;
+    memmove(r->buf, r->buf + from, r->len - from);
+    r->len -= from;
+    r->pos -= from;
+    if (r->keep != NO_KEEP) r->keep -= from;
+
+    // Only a token longer than the buffer makes it grow
+    if (r->size - r->len < READ_BUFFER_SIZE / 2) {
+        r->size *= 2;
+        r->buf = realloc(r->buf, r->size);
+    }
+
+    size_t n = r->port != NULL
+        ? read_port_bytes(r->port, r->buf + r->len, r->size - r->len - 1)
+        : fread(r->buf + r->len, 1, r->size - r->len - 1, r->file);
+    r->len += n;
+    r->buf[r->len] = 0;
+    return n > 0;
+}
+
+// The character i after the current one, 0 at the end of the text
+static inline int peek(Reader *r, size_t i) {
+    while (r->pos + i >= r->len) {
+        if (!refill(r)) return 0;
+    }
+    return (unsigned char)r->buf[r->pos + i];
+}
 
-        ++*ptext;
+// Returns i moved past the run of characters from pos + i on that span (see
+// scan.h) accepts, reading more of the file while the run goes on
+static inline size_t skip(Reader *r, size_t i, size_t (*span)(const char *, size_t)) {
+    for (;;) {
+        i += span(r->buf + r->pos + i, r->len - r->pos - i);
+        if (r->pos + i < r->len || !refill(r)) return i;
     }
 }
 
-static Value *parse_atom(const char **ptext) {
-    const char *start = *ptext;
+static Value *parse_value(Reader *r);
+
+static void ignore_whitespace(Reader *r) {
+    for (;;) {
+        int ch = peek(r, 0);
+
+        // Mostly there is no space, or just one, before a token
+        if (isspace(ch)) {
+            r->pos++;
+            if (isspace(peek(r, 0))) r->pos += skip(r, 0, span_space);
+            continue;
+        }
+        if (ch != ';') break;
 
-    while (isgraph(**ptext) && **ptext != '(' && **ptext != ')') {
-        ++*ptext;
+        const char *end;
+        while ((end = memchr(r->buf + r->pos, '\n', r->len - r->pos)) == NULL) {
+            r->pos = r->len;
+            if (!refill(r)) return;
+        }
+        r->pos = end - r->buf;
     }
+}
+
+// Starts a token that is to stay in the buffer until end_token()
+static void start_token(Reader *r) {
+    r->keep = r->pos;
+}
 
-    return create_atom_alloced(strndup(start, *ptext - start));
+static const char *end_token(Reader *r, size_t *len) {
+    const char *start = r->buf + r->keep;
+    *len = r->pos - r->keep;
+    r->keep = NO_KEEP;
+    return start;
 }
 
-static Value *parse_list(const char **ptext) {
+static Value *parse_atom(Reader *r) {
+    size_t len;
+
+    start_token(r);
+    r->pos += skip(r, 0, span_token);
+
+    const char *start = end_token(r, &len);
+    return intern_n(start, len);
+}
+
+static Value *parse_list(Reader *r) {
     Value *ls = NULL;
     Value **next = &ls;
 
     while (1) {
-        ignore_whitespace(ptext);
-        if (**ptext == ')' || **ptext == 0) {
-            ++*ptext;
+        ignore_whitespace(r);
+
+        int ch = peek(r, 0);
+        if (ch == ')' || ch == 0) {
+            if (ch) r->pos++;
             break;
         }
 
-        *next = cons(parse_value(ptext), NULL);
+        *next = cons(parse_value(r), NULL);
         next = &CDR(*next);
     }
 
     return ls;
 }
 
+// #(a b c)
+static Value *parse_vector(Reader *r) {
+    r->pos += 2;
+
+    Value *ls = parse_list(r);
+    Value *v = list_to_vector(ls);
+    delete_value(ls);
+    return v;
+}
+
 static void add_char_to_str(char ch, char **pstr, size_t *pstr_len, size_t *pstr_size) {
     if (*pstr_len + 1 >= *pstr_size) {
         *pstr_size <<= 1;
@@ -76,15 +259,25 @@ static void add_char_to_str(char ch, char **pstr, size_t *pstr_len, size_t *pstr
     ++*pstr_len;
 }
 
-static Value *parse_string(const char **ptext) {
-    size_t str_len = 0, str_size = 16;
-    char *str = malloc((str_size + 1) * sizeof(char));
+static Value *parse_string(Reader *r) {
+    size_t str_len = 0, str_size;
+    char *str;
+    int ch;
+
+    r->pos++;
+
+    // Everything up to the first escape is copied in one go
+    str_len = skip(r, 0, span_string);
 
-    ++*ptext;
+    str_size = str_len + 16;
+    str = malloc((str_size + 1) * sizeof(char));
+    memcpy(str, r->buf + r->pos, str_len);
+    r->pos += str_len;
 
-    while (**ptext != '"' && **ptext) {
-        if (**ptext == '\\') {
-            switch (*++*ptext) {
+    while ((ch = peek(r, 0)) != '"' && ch) {
+        if (ch == '\\') {
+            r->pos++;
+            switch (ch = peek(r, 0)) {
             case 'n':
                 add_char_to_str('\n', &str, &str_len, &str_size);
                 break;
@@ -92,68 +285,206 @@ static Value *parse_string(const char **ptext) {
                 add_char_to_str('\t', &str, &str_len, &str_size);
                 break;
             default:
-                add_char_to_str(**ptext, &str, &str_len, &str_size);
+                add_char_to_str(ch, &str, &str_len, &str_size);
                 break;
             }
+            if (ch == 0) break;
         } else {
-            add_char_to_str(**ptext, &str, &str_len, &str_size);
+            add_char_to_str(ch, &str, &str_len, &str_size);
         }
-        ++*ptext;
+        r->pos++;
     }
 
-    if (**ptext == '"') ++*ptext;
+    if (peek(r, 0) == '"') r->pos++;
 
     str[str_len] = 0;
     return create_string_alloced(str);
 }
 
-static Value *parse_value(const char **ptext) {
-    Value *v;
+static Value *parse_num(Reader *r) {
+    size_t len;
+
+    start_token(r);
+    if (peek(r, 0) == '-') r->pos++;
+    while (isdigit(peek(r, 0)) || peek(r, 0) == '.') r->pos++;
+
+    // A mapped file isn't NUL terminated, so the token is bounded by its length
+    const char *text = end_token(r, &len);
+    return create_number(parse_number(&text, text + len));
+}
+
+static const struct {
+    const char *name;
+    char ch;
+} char_names[] = {
+    { "space", ' ' },
+    { "newline", '\n' },
+    { "tab", '\t' },
+};
+
+#define CHAR_NAME_COUNT (sizeof char_names / sizeof char_names[0])
+
+// #\a, #\space
+static Value *parse_char(Reader *r) {
+    size_t len;
+
+    r->pos += 2;
+    if (peek(r, 0) == 0) {
+        return create_exception("Expected a character after #\\");
+    }
+
+    start_token(r);
+    r->pos++;
+    r->pos += skip(r, 0, span_token);
+
+    const char *start = end_token(r, &len);
+    if (len == 1) return CHAR(*start);
+
+    for (size_t i = 0; i < CHAR_NAME_COUNT; i++) {
+        if (!strncmp(char_names[i].name, start, len) && char_names[i].name[len] == 0) {
+            return CHAR(char_names[i].ch);
+        }
+    }
+
+    return create_exception("Unknown character name '%.*s'", (int)len, start);
+}
 
-    ignore_whitespace(ptext);
-
-    if (isdigit(**ptext) || (**ptext == '-' && isdigit((*ptext)[1]))) {
-        v = create_number(parse_number(ptext));
-    } else if (**ptext == '(') {
-        ++*ptext;
-        v = parse_list(ptext);
-    } else if (**ptext == '"') {
-        v = parse_string(ptext);
-    } else if (isgraph(**ptext)) {
-        v = parse_atom(ptext);
-    } else if (**ptext == EOF) {
-        v = NULL;
+static void print_char(Port *port, char ch) {
+    for (size_t i = 0; i < CHAR_NAME_COUNT; i++) {
+        if (char_names[i].ch == ch) {
+            port_printf(port, "#\\%s", char_names[i].name);
+            return;
+        }
+    }
+    port_printf(port, "#\\%c", ch);
+}
+
+// 'x, `x, ,x and ,@x
+static Value *parse_quoted(Reader *r) {
+    const char *name;
+    int ch = peek(r, 0);
+
+    if (ch == '\'') {
+        name = "quote";
+    } else if (ch == '`') {
+        name = "quasiquote";
+    } else if (peek(r, 1) == '@') {
+        name = "unquote-splicing";
+        r->pos++;
     } else {
-        return create_exception("Unexpected character '%c' (%x)", **ptext, **ptext);
+        name = "unquote";
     }
+    r->pos++;
 
-    return v;
+    Value *v = parse_value(r);
+    if (TYPEOF(v) == TYPE_EXCEPTION) return v;
+    return cons(intern(name), cons(v, NULL));
+}
+
+static Value *parse_value(Reader *r) {
+    ignore_whitespace(r);
+
+    int ch = peek(r, 0);
+
+    if (isdigit(ch) || (ch == '-' && isdigit(peek(r, 1)))) {
+        return parse_num(r);
+    } else if (ch == '(') {
+        r->pos++;
+        return parse_list(r);
+    } else if (ch == '"') {
+        return parse_string(r);
+    } else if (ch == '#' && peek(r, 1) == '\\') {
+        return parse_char(r);
+    } else if (ch == '#' && peek(r, 1) == '(') {
+        return parse_vector(r);
+    } else if (ch == '\'' || ch == '`' || ch == ',') {
+        return parse_quoted(r);
+    } else if (isgraph(ch)) {
+        return parse_atom(r);
+    } else if (ch == 0) {
+        return NULL;
+    }
+
+    r->pos++;
+    return create_exception("Unexpected character '%c' (%x)", ch, ch);
+}
+
+// Reads the next top-level form into dst, returns 0 at the end of the text
+static int read_form(Reader *r, Value **dst) {
+    ignore_whitespace(r);
+
+    int ch = peek(r, 0);
+    if (ch == 0 || ch == ')') return 0;
+
+    release_parsed(r);
+    *dst = parse_value(r);
+    return 1;
 }
 
 Value *parse(const char *text) {
-    return parse_value(&text);
+    Reader r;
+    open_string_reader(&r, text);
+
+    Value *v = parse_value(&r);
+    close_reader(&r);
+    return v;
 }
 
-void print(Value *v) {
+Value *read_datum(Port *port) {
+    // Also makes sure the port has its buffer
+    if (port_peekc(port) < 0) return copy_value(&eof_object);
+
+    Reader r = { NULL, port, port->buf, port->pos, port->len, port->size, NO_KEEP, 0, 0 };
+    Value *v;
+
+    ignore_whitespace(&r);
+    if (peek(&r, 0) == 0) {
+        v = copy_value(&eof_object);
+    } else {
+        v = parse_value(&r);
+    }
+
+    // Refills may have moved or grown the buffer
+    port->buf = r.buf;
+    port->pos = r.pos;
+    port->len = r.len;
+    port->size = r.size;
+    return v;
+}
+
+void write_value(Port *port, Value *v, int display) {
     switch (TYPEOF(v)) {
     case TYPE_NULL:
-        printf("()");
+        port_puts(port, "()");
         break;
     case TYPE_ATOM:
-        printf("%s", v->value.atom);
+        port_puts(port, v->value.atom);
         break;
     case TYPE_STRING:
-        printf("\"%s\"", v->value.string);
+        if (!display) port_putc(port, '"');
+        port_write(port, string_chars(v), string_len(v));
+        if (!display) port_putc(port, '"');
         break;
     case TYPE_NUMBER:
-        if (v->value.number.type == NUMBER_LLONG) {
-            printf("%lld", v->value.number.v.ll);
+        if (number_of(v).type == NUMBER_LLONG) {
+            port_printf(port, "%lld", number_of(v).v.ll);
+        } else if (number_of(v).type == NUMBER_DOUBLE) {
+            port_printf(port, "%g", number_of(v).v.d);
+        } else {
+            char *str = format_number(number_of(v));
+            port_puts(port, str);
+            free(str);
+        }
+        break;
+    case TYPE_CHAR:
+        if (display) {
+            port_putc(port, CHAR_VALUE(v));
         } else {
-            printf("%g", v->value.number.v.d);
+            print_char(port, CHAR_VALUE(v));
         }
         break;
     case TYPE_LIST:
-        printf("(");
+        port_puts(port, "(");
 
         // TODO fix assumes cdr is LIST
         int first = 1;
@@ -161,51 +492,113 @@ void print(Value *v) {
             if (first) {
                 first = 0;
             } else {
-                fputc(' ', stdout);
+                port_putc(port, ' ');
             }
 
-            print(it->value.list.car);
+            write_value(port, it->value.list.car, display);
         }
 
-        printf(")");
+        port_puts(port, ")");
+        break;
+    case TYPE_VECTOR:
+        port_puts(port, "#(");
+        for (size_t i = 0; i < v->value.vector.len; i++) {
+            if (i > 0) port_putc(port, ' ');
+            write_value(port, v->value.vector.items[i], display);
+        }
+        port_puts(port, ")");
         break;
     case TYPE_FUNCTION:
     case TYPE_FUNCTION_SF:
-        if (v->type == TYPE_FUNCTION) {
-            printf("(lambda ");
+    case TYPE_MACRO:
+        if (v->type == TYPE_MACRO) {
+            port_puts(port, "[macro]");
+            break;
+        } else if (v->type == TYPE_FUNCTION) {
+            port_puts(port, "(lambda ");
         } else {
-            printf("(macro ");
+            port_puts(port, "(macro ");
         }
-        print(v->value.func.operands);
-        printf(" ");
-        print(v->value.func.body);
-        printf(")");
+        write_value(port, v->value.func.operands, display);
+        port_puts(port, " ");
+        write_value(port, v->value.func.body, display);
+        port_puts(port, ")");
         break;
     case TYPE_BUILTIN:
     case TYPE_BUILTIN_SF:
-        printf("[builtin]");
+        port_puts(port, "[builtin]");
+        break;
+    case TYPE_HASHTABLE:
+        port_puts(port, "[hash-table]");
+        break;
+    case TYPE_PORT:
+        port_puts(port, "[port]");
+        break;
+    case TYPE_EOF:
+        port_puts(port, "[eof]");
+        break;
+    case TYPE_BYTEVECTOR:
+        port_puts(port, "#u8(");
+        for (size_t i = 0; i < bytevector_len(v); i++) {
+            port_printf(port, i > 0 ? " %u" : "%u", bytevector_data(v)[i]);
+        }
+        port_puts(port, ")");
+        break;
+    case TYPE_F64VECTOR:
+        port_puts(port, "#f64(");
+        for (size_t i = 0; i < v->value.numvector.len; i++) {
+            port_printf(port, i > 0 ? " %g" : "%g", v->value.numvector.f64[i]);
+        }
+        port_puts(port, ")");
+        break;
+    case TYPE_S64VECTOR:
+        port_puts(port, "#s64(");
+        for (size_t i = 0; i < v->value.numvector.len; i++) {
+            port_printf(port, i > 0 ? " %lld" : "%lld", (long long)v->value.numvector.s64[i]);
+        }
+        port_puts(port, ")");
         break;
     case TYPE_BOOLEAN:
-        if (v->value.boolean) {
-            printf("#t");
+        if (v == TRUE) {
+            port_puts(port, "#t");
         } else {
-            printf("#f");
+            port_puts(port, "#f");
         }
         break;
     case TYPE_EXCEPTION:
     case TYPE_BOUND_EXCEPTION:
-        printf("exception: %s", v->value.exception);
+        port_printf(port, "exception: %s", v->value.exception);
+        break;
+    case TYPE_ENV:
         break;
     }
 }
 
+void print(Value *v) {
+    write_value(current_output, v, 0);
+}
+
+// Evaluates the car of a list cell, using its lexical address if it is a variable
+Value *eval_car(Value *cell, Env *env) {
+    Value *var;
+
+    if (TYPEOF(CAR(cell)) != TYPE_ATOM) {
+        return eval(CAR(cell), env);
+    }
+
+    if (!resolve_cell(cell, env, &var)) {
+        return create_exception("Could not resolve '%s'", CAR(cell)->value.atom);
+    }
+    return copy_value(var);
+}
+
 static Value *eval_list(Value *v, Env *env) {
     Value *res;
     Value *ls = NULL;
     Value **next = &ls;
 
     while (v != NULL) {
-        res = eval(car(v), env);
+        res = eval_car(v, env);
 
         // Bubble exceptions
         if (TYPEOF(res) == TYPE_EXCEPTION) {
@@ -221,47 +614,53 @@ static Value *eval_list(Value *v, Env *env) {
     return ls;
 }
 
-static int bind_rest_of_args(Value **parg, Value **pparam, Env *frame, int do_eval) {
-    // FIXME sloppy sloppy sloppy!!!
-    if (TYPEOF(car(cdr(*pparam))) != TYPE_ATOM) {
-        return 0;
-    }
+// Creates func's frame for a call and binds the arguments in it. Returns an
+// exception on error, NULL otherwise.
+static Value *bind_args(Value *func, Value *args, Env *env, int do_eval, Env **dst) {
+    static Value *rest = NULL;
+    if (rest == NULL) rest = intern("&rest");
 
-    const char *name = car(cdr(*pparam))->value.atom;
-    *pparam = cdr(cdr(*pparam));
+    assert(IS_FUNCTION(func) || func->type == TYPE_MACRO);
 
-    Value *ls = NULL;
-    Value **next = &ls;
+    // Functions close over the environment they were created in, macros are
+    // evaluated in the caller's so they can eval their operands there
+    Env *parent = func->type == TYPE_FUNCTION_SF ? env : func->value.func.env;
+    Env *frame = create_frame(parent, func->nslots);
 
-    while (*parg != NULL) {
-        Value *arg_val = do_eval
-            ? eval(car(*parg), frame)
-            : copy_value(car(*parg));
+    // Bind the arguments in the new stack frame
+    Value *arg = args, *param = func->value.func.operands;
+    EnvSlot *slot = frame->slots;
 
-        *next = cons(arg_val, NULL);
-        next = &CDR(*next);
-        *parg = cdr(*parg);
-    }
+    while (param != NULL) {
+        if (car(param) == rest) {
+            // Remaining arguments are bound as a list, make_func checked
+            // there is exactly one name after &rest
+            Value *ls = NULL;
+            Value **next = &ls;
 
-    add_to_env(frame, name, ls);
-    return 1;
-}
+            slot->name = car(cdr(param));
+            slot->value = NULL;
 
-static Value *apply_user_func(Value *func, Value *args, Env *env, int do_eval) {
-    assert(IS_FUNCTION(func));
+            for (; arg != NULL; arg = cdr(arg)) {
+                Value *arg_val = do_eval ? eval_car(arg, env) : copy_value(car(arg));
 
-    Env *frame = create_env(env);
+                if (TYPEOF(arg_val) == TYPE_EXCEPTION) {
+                    delete_value(ls);
+                    delete_env(frame);
+                    return arg_val;
+                }
 
-    // Bind the arguments in the new stack frame
-    Value *arg = args, *param = func->value.func.operands;
+                *next = cons(arg_val, NULL);
+                next = &CDR(*next);
+            }
 
-    while (arg != NULL && param != NULL) {
-        assert(TYPEOF(car(param)) == TYPE_ATOM);
+            slot->value = ls;
+            break;
+        }
 
-        Value *arg_val = do_eval
-            ? eval(car(arg), env)
-            : copy_value(car(arg));
+        if (arg == NULL) break;
 
+        Value *arg_val = do_eval ? eval_car(arg, env) : copy_value(car(arg));
 
         // Bubble exceptions
         if (TYPEOF(arg_val) == TYPE_EXCEPTION) {
@@ -269,90 +668,200 @@ static Value *apply_user_func(Value *func, Value *args, Env *env, int do_eval) {
             return arg_val;
         }
 
-        if (!strcmp(car(param)->value.atom, "&rest")) {
-            if (!bind_rest_of_args(&arg, &param, frame, do_eval)) {
-                delete_env(frame);
-                return create_exception("&rest must be followed by name");
-            }
-            break;
-        }
-
-        add_to_env(frame, car(param)->value.atom, arg_val);
+        slot->name = car(param);
+        slot->value = arg_val;
+        slot += 1;
 
         arg = cdr(arg);
         param = cdr(param);
     }
 
-    if (param != NULL || arg != NULL) {
-        if (param != NULL && !strcmp(car(param)->value.atom, "&rest")) {
-            // special case when 0 args passed to &rest
-            bind_rest_of_args(&arg, &param, frame, do_eval);
-        } else {
-            delete_env(frame);
-            return create_exception("argument/parameter mismatch");
-        }
+    if (arg != NULL || (param != NULL && car(param) != rest)) {
+        delete_env(frame);
+        return create_exception("argument/parameter mismatch");
     }
 
+    *dst = frame;
+    return NULL;
+}
+
+static Value *apply_user_func(Value *func, Value *args, Env *env, int do_eval) {
+    Env *frame;
+    Value *err = bind_args(func, args, env, do_eval, &frame);
+    if (err) return err;
+
     Value *ret = eval(func->value.func.body, frame);
     delete_env(frame);
     return ret;
 }
 
+Value *apply_macro(Value *macro, Value *operands) {
+    return apply_user_func(macro, operands, NULL, 0);
+}
+
 // Doesn't eval arguments
 Value *apply_func(Value *func, Value *args, Env *env) {
-    if (IS_BUILTIN(args)) {
-        return func->value.builtin(args, env);
+    if (IS_BUILTIN(func)) {
+        Value *ret = func->value.builtin(args, env);
+        return ret == TAIL ? eval_tail(env) : ret;
     } else if (IS_FUNCTION(func)) {
         return apply_user_func(func, args, env, 0);
     }
     return create_exception("Cannot apply value of type %s", type_names[TYPEOF(func)]);
 }
 
+Value *tail_expr;
+Env *tail_frame;
+
+Value *eval_tail(Env *env) {
+    Env *frame = tail_frame;
+
+    if (frame == NULL) return eval(tail_expr, env);
+
+    tail_frame = NULL;
+    Value *ret = eval(tail_expr, frame);
+    delete_env(frame);
+    return ret;
+}
+
+// Calls in tail position don't recurse: eval loops with the new expression
+// instead, so iterative loops run in constant C stack. What the expression
+// lives in is kept alive by `callee` (the body of the function being run) or
+// `code` (a list built at runtime and passed to eval), and `frame` is the
+// frame of the function being run. Each is released as soon as a tail call
+// replaces it.
 Value *eval(Value *v, Env *env) {
     Value *var;
     Value *func;
+    Value *ret;
+    Value *callee = NULL, *code = NULL;
+    Env *frame = NULL;
 
     //printf("Evaling: ");
     //print(v);
     //puts("");
 
-    switch (TYPEOF(v)) {
+    for (;;) switch (TYPEOF(v)) {
         case TYPE_ATOM:
-            if (!resolve(env, v->value.atom, &var)) {
-                return create_exception("Could not resolve '%s'", v->value.atom);
+            if (!resolve(env, v, &var)) {
+                ret = create_exception("Could not resolve '%s'", v->value.atom);
+            } else {
+                ret = copy_value(var);
             }
-            return copy_value(var);
+            goto done;
 
         case TYPE_LIST:
-            func = eval(car(v), env);
+            func = eval_car(v, env);
 
             if (TYPEOF(func) == TYPE_BUILTIN) {
                 Value *args = eval_list(cdr(v), env);
 
                 // Bubble exceptions, don't call function
-                if (TYPEOF(args) == TYPE_EXCEPTION) return args;
+                if (TYPEOF(args) == TYPE_EXCEPTION) {
+                    delete_value(func);
+                    ret = args;
+                    goto done;
+                }
 
-                Value *ret = func->value.builtin(args, env);
+                if (func->value.builtin != eval_block || args == NULL) {
+                    ret = func->value.builtin(args, env);
+                    delete_value(args);
+                    delete_value(func);
+                    goto done;
+                }
+
+                // eval: run all but the last line here, continue with that
+                Value *line = args;
+                for (; cdr(line) != NULL; line = cdr(line)) {
+                    Value *expanded = expand(car(line), env);
+                    ret = eval(expanded, env);
+                    delete_value(expanded);
+                    if (TYPEOF(ret) == TYPE_EXCEPTION) {
+                        delete_value(args);
+                        delete_value(func);
+                        goto done;
+                    }
+                    delete_value(ret);
+                }
+
+                Value *last = expand(car(line), env);
                 delete_value(args);
-                return ret;
+                delete_value(func);
+                delete_value(code);
+                delete_value(callee);
+                callee = NULL;
+                v = code = last;
             } else if (TYPEOF(func) == TYPE_BUILTIN_SF) {
-                return func->value.builtin(cdr(v), env);
+                ret = func->value.builtin(cdr(v), env);
+                delete_value(func);
+                if (ret != TAIL) goto done;
+
+                // A subexpression of v, alive as long as v is
+                v = tail_expr;
+
+                if (tail_frame != NULL) {
+                    // let: its frame replaces the current one like a call's
+                    if (frame) delete_env(frame);
+                    env = frame = tail_frame;
+                    tail_frame = NULL;
+                }
             } else if (IS_FUNCTION(func)) {
-                Value *args = cdr(v);
-                return apply_user_func(func, args, env, func->type == TYPE_FUNCTION);
+                Env *next;
+                ret = bind_args(func, cdr(v), env, func->type == TYPE_FUNCTION, &next);
+                if (ret) {
+                    delete_value(func);
+                    goto done;
+                }
+
+                // The caller's frame is dead unless something captured it
+                if (frame) delete_env(frame);
+                env = frame = next;
+
+                delete_value(code);
+                delete_value(callee);
+                code = NULL;
+                callee = func;
+                v = func->value.func.body;
+            } else if (TYPEOF(func) == TYPE_MACRO) {
+                // Only calls that were not there when the code was expanded
+                // get here
+                ret = apply_macro(func, cdr(v));
+                delete_value(func);
+                if (TYPEOF(ret) == TYPE_EXCEPTION) goto done;
+
+                delete_value(code);
+                v = code = ret;
             } else if (TYPEOF(func) == TYPE_EXCEPTION) {
-                return func;
+                ret = func;
+                goto done;
             } else {
                 // NOT applyable!
-                return create_exception("Cannot apply value of type %s", type_names[TYPEOF(func)]);
+                enum Type type = TYPEOF(func);
+                delete_value(func);
+                ret = create_exception("Cannot apply value of type %s", type_names[type]);
+                goto done;
             }
             break;
 
         default:
-            return copy_value(v);
+            ret = copy_value(v);
+            goto done;
     }
 
-    return NULL;
+done:
+    if (frame) delete_env(frame);
+    delete_value(callee);
+    delete_value(code);
+    return ret;
+}
+
+// Evaluates a form read by run_script or the REPL, or passed to eval, once
+// its macros are expanded
+static Value *eval_form(Value *form, Env *env) {
+    Value *expanded = expand(form, env);
+    Value *ret = use_vm ? vm_eval(expanded, env) : eval(expanded, env);
+    delete_value(expanded);
+    return ret;
 }
 
 Value *eval_block(Value *lines, Env *env) {
@@ -360,13 +869,15 @@ Value *eval_block(Value *lines, Env *env) {
 
     while (lines != NULL) {
         delete_value(ret);
-        ret = eval(car(lines), env);
+        ret = eval_form(car(lines), env);
         lines = cdr(lines);
     }
 
     return ret;
 }
 
+// Evaluates each form as soon as it is read, so the file only has to fit in
+// memory one form at a time
 Value *run_script(const char *filename, Env *env) {
     FILE *f = fopen(filename, "r");
 
@@ -374,35 +885,84 @@ Value *run_script(const char *filename, Env *env) {
         return create_exception("Cannot open file '%s'.", filename);
     }
 
-    fseek(f, 0, SEEK_END);
-    size_t size = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    Value *result = NULL, *form;
+    Fasl *fasl = use_fasl ? open_fasl(filename, f) : NULL;
+    size_t done = 0;
+
+    if (fasl != NULL) {
+        int status;
+        while ((status = read_fasl(fasl, &form)) > 0) {
+            delete_value(result);
+            result = eval_form(form, env);
+            delete_value(form);
+            done++;
+        }
+
+        close_fasl(fasl);
+        if (status == 0) {
+            fclose(f);
+            return result;
+        }
+    }
+
+    Reader r;
+    if (!open_mapped_reader(&r, f)) open_file_reader(&r, f);
 
-    char *text = malloc(size + 1);
-    text[size] = 0;
-    fread(text, 1, size, f);
+    // Forms are saved before they are evaluated, which may change them
+    fasl = use_fasl ? create_fasl(filename, f) : NULL;
 
-    fclose(f);
+    while (read_form(&r, &form)) {
+        if (fasl != NULL) write_fasl(fasl, form);
 
-    const char *text2 = text;
-    Value *parsed = parse_list(&text2);
-    Value *result = eval_block(parsed, env);
+        // Already run from a cache that broke off
+        if (done > 0) {
+            done--;
+            delete_value(form);
+            continue;
+        }
 
-    delete_value(parsed);
-    free(text);
+        delete_value(result);
+        result = eval_form(form, env);
+        delete_value(form);
+    }
 
+    if (fasl != NULL) finish_fasl(fasl);
+    close_reader(&r);
+    fclose(f);
     return result;
 }
 
-static int handle_options(int argc, char **argv, Env *env) {
+// Prints the message of an exception from starting up and exits
+static void fail_with(Value *exception) {
+    flush_port(&stdout_port);
+    fprintf(stderr, "Error: %s\n", exception->value.exception);
+    exit(EXIT_FAILURE);
+}
+
+// Sets up global_env
+static int handle_options(int argc, char **argv) {
     int force_interactive = 0;
     int flags = FLAG_INTERACTIVE | FLAG_NO_STDLIB;
 
     int script_count = 0;
     char *scripts[100];
+    const char *image = NULL, *dump = NULL;
 
     for (int i = 1; i < argc; i++) {
-        if (argv[i][0] == '-') {
+        if (!strcmp(argv[i], "--image") || !strcmp(argv[i], "--dump-image")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Option %s requires a file name\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+
+            if (!strcmp(argv[i], "--image")) {
+                image = argv[i + 1];
+            } else {
+                dump = argv[i + 1];
+                if (!force_interactive) flags &= ~FLAG_INTERACTIVE;
+            }
+            i++;
+        } else if (argv[i][0] == '-') {
             switch (argv[i][1]) {
             case 'h':
                 printf(
@@ -419,6 +979,21 @@ static int handle_options(int argc, char **argv, Env *env) {
                     "        Do not include the standard library.\n"
                     "    -p\n"
                     "        Print the parsed object in interactive mode.\n"
+                    "    -r\n"
+                    "        Return memory that is no longer used to the OS.\n"
+                    "    -b\n"
+                    "        Compile to bytecode and run it on the VM instead of\n"
+                    "        walking the parsed code.\n"
+                    "    -c\n"
+                    "        Cache the parsed forms of each script in a .fasl file\n"
+                    "        next to it, and load them from there while the script\n"
+                    "        is unchanged.\n"
+                    "    --image [file]\n"
+                    "        Start from the heap image in file instead of a fresh\n"
+                    "        environment and the standard library.\n"
+                    "    --dump-image [file]\n"
+                    "        Save the global environment as a heap image once the\n"
+                    "        standard library and scripts have run.\n"
                     "\n", argv[0]
                 );
                 exit(0);
@@ -455,6 +1030,18 @@ static int handle_options(int argc, char **argv, Env *env) {
                 flags |= FLAG_PRINT_PARSED;
                 break;
 
+            case 'r':
+                slab_release_pages = 1;
+                break;
+
+            case 'b':
+                use_vm = 1;
+                break;
+
+            case 'c':
+                use_fasl = 1;
+                break;
+
             default:
                 fprintf(stderr, "Warning: unknown option '%s'\n", argv[i]);
                 break;
@@ -462,13 +1049,28 @@ static int handle_options(int argc, char **argv, Env *env) {
         }
     }
 
-    if (~flags & FLAG_NO_STDLIB) {
-        // FIXME
-        delete_value(run_script(STDLIB_PATH, env));
+    Value *error;
+
+    if (image != NULL) {
+        // The image already has the standard library in it
+        error = load_image(image, &global_env);
+        if (error) fail_with(error);
+    } else {
+        global_env = create_global_env();
+
+        if (~flags & FLAG_NO_STDLIB) {
+            // FIXME
+            delete_value(run_script(STDLIB_PATH, global_env));
+        }
     }
 
     for (int i = 0; i < script_count; i++) {
-        delete_value(run_script(scripts[i], env));
+        delete_value(run_script(scripts[i], global_env));
+    }
+
+    if (dump != NULL) {
+        error = dump_image(dump, global_env);
+        if (error) fail_with(error);
     }
 
     return flags;
@@ -508,29 +1110,31 @@ static int completing_function(const char *text, int start) {
 
 static char *global_variable_generator(const char *text, int state, int only_functions) {
     static int len;
-    static Env *env;
-    static EnvElem *elem;
+    static unsigned index;
 
-    EnvElem *curr;
+    EnvTable *table = global_env->table;
+    const char *name;
+    Value *value;
 
     if (state == 0) {
-        env = global_env;
         len = strlen(text);
-        elem = env->first;
+        index = 0;
     }
 
-    while (env != NULL) {
-        while (elem != NULL) {
-            curr = elem;
-            elem = elem->next;
-
-            if ((!only_functions || IS_CALLABLE(curr->value)) && !strncmp(curr->name, text, len)) {
-                return strdup(curr->name);
-            }
+    // Everything defined so far, then the builtins that have not been used yet
+    while (index < table->size + builtin_count) {
+        if (index < table->size) {
+            name = table->slots[index] ? table->slots[index]->name->value.atom : NULL;
+            value = table->slots[index] ? table->slots[index]->value : NULL;
+        } else {
+            name = builtin_names[index - table->size];
+            value = builtin_values[index - table->size];
         }
+        index += 1;
 
-        env = env->parent;
-        if (env) elem = env->first;
+        if (name && (!only_functions || IS_CALLABLE(value)) && !strncmp(name, text, len)) {
+            return strdup(name);
+        }
     }
 
     return NULL;
@@ -578,8 +1182,7 @@ char *readline(const char *prompt) {
 #endif
 
 int main(int argc, char **argv) {
-    global_env = create_global_env();
-    int flags = handle_options(argc, argv, global_env);
+    int flags = handle_options(argc, argv);
 
     if (flags & FLAG_INTERACTIVE) {
 #ifdef USE_READLINE
@@ -587,21 +1190,22 @@ int main(int argc, char **argv) {
 #endif
 
         while (!feof(stdin)) {
+            flush_port(&stdout_port);
             char *input = readline("> ");
             if (!input) break;
 
             Value *parsed = parse(input);
-            Value *result = eval(parsed, global_env);
+            Value *result = eval_form(parsed, global_env);
 
             if (flags & FLAG_PRINT_PARSED) {
-                printf("%% ");
+                port_puts(&stdout_port, "% ");
                 print(parsed);
-                puts("");
+                port_putc(&stdout_port, '\n');
             }
 
             if (result) {
                 print(result);
-                puts("");
+                port_putc(&stdout_port, '\n');
                 delete_value(result);
             }
 
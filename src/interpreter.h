@@ -4,8 +4,42 @@
 #include "value.h"
 
 Value *eval(Value *v, Env *env);
+Value *eval_car(Value *cell, Env *env);
 Value *eval_block(Value *v, Env *env);
 
+// The expansion of one call to macro, not expanded further
+Value *apply_macro(Value *macro, Value *operands);
+
+// Special forms return TAIL to have eval continue with tail_expr, in the
+// environment they were called in, instead of evaluating it themselves. The
+// expression must be part of their operands.
+#define TAIL ((Value *)0x06)
+extern Value *tail_expr;
+
+// Set by tail_call_in(), for expressions to be evaluated in a new frame. The
+// reference to it passes on with TAIL.
+extern Env *tail_frame;
+
+static inline Value *tail_call(Value *expr) {
+    tail_expr = expr;
+    return TAIL;
+}
+
+static inline Value *tail_call_in(Value *expr, Env *frame) {
+    tail_frame = frame;
+    return tail_call(expr);
+}
+
+// Evaluates what a special form called in env returned TAIL for
+Value *eval_tail(Env *env);
+
+// The next datum in port, eof_object at its end
+Value *read_datum(Port *port);
+
+// Writes v to port as write does, or as display does if display is set
+void write_value(Port *port, Value *v, int display);
+
+// Writes v to current_output
 void print(Value *);
 
 #endif
@@ -1,5 +1,7 @@
 #include <ctype.h>
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include "number.h"
 
 Number create_number_ll(long long x) {
@@ -18,18 +20,33 @@ Number create_number_d(double x) {
     return n;
 }
 
+Number create_number_big(BigInt *big) {
+    long long x;
+    if (bigint_to_ll(big, &x)) {
+        free_bigint(big);
+        return create_number_ll(x);
+    }
+
+    Number n = {
+        .type = NUMBER_BIGINT,
+        .v.big = big
+    };
+    return n;
+}
+
 // TODO scientific notation
-Number parse_number(const char **pstr) {
+Number parse_number(const char **pstr, const char *end) {
     double after_decimal = 0.;
-    long long neg = 1;
+    long long neg = 1, digits;
     Number n = create_number_ll(0);
 
-    if (**pstr == '-') {
+    if (*pstr < end && **pstr == '-') {
         neg = -1;
         ++*pstr;
     }
 
-    while (isdigit(**pstr) || **pstr == '.') {
+    const char *start = *pstr;
+    while (*pstr < end && (isdigit(**pstr) || **pstr == '.')) {
         if (**pstr == '.') {
             after_decimal = .1;
             if (n.type == NUMBER_LLONG) {
@@ -37,14 +54,24 @@ Number parse_number(const char **pstr) {
                 n.v.d = n.v.ll;
             }
         } else if (after_decimal != 0.) {
-            n = add_number(n,
-                    mul_number(
-                        create_number_ll(**pstr - '0'),
-                        create_number_d(after_decimal)));
+            n.v.d += (**pstr - '0') * after_decimal;
             after_decimal *= .1;
+        } else if (n.type == NUMBER_DOUBLE) {
+            n.v.d = n.v.d * 10 + (**pstr - '0');
+        } else if (!__builtin_smulll_overflow(n.v.ll, 10, &digits)
+                && !__builtin_saddll_overflow(digits, **pstr - '0', &digits)) {
+            n.v.ll = digits;
         } else {
-            n = mul_number(n, create_number_ll(10));
-            n = add_number(n, create_number_ll(**pstr - '0'));
+            // Too long for a long long, unless it has a fraction
+            const char *last = *pstr;
+            while (last < end && isdigit(*last)) last++;
+
+            if (last == end || *last != '.') {
+                *pstr = last;
+                return create_number_big(parse_bigint(start, last - start, neg < 0));
+            }
+            n = create_number_d(n.v.ll);
+            continue;
         }
         ++*pstr;
     }
@@ -52,94 +79,133 @@ Number parse_number(const char **pstr) {
     return mul_number(n, create_number_ll(neg));
 }
 
-static void cast_types(Number a_in, Number b_in, Number *a_out, Number *b_out) {
-    if (a_in.type == b_in.type) {
-        *a_out = a_in;
-        *b_out = b_in;
-    } else if (a_in.type == NUMBER_DOUBLE) {
-        *a_out = a_in;
-        *b_out = create_number_d(b_in.v.ll);
-    } else {
-        *a_out = create_number_d(a_in.v.ll);
-        *b_out = b_in;
+double number_to_double(Number n) {
+    switch (n.type) {
+    case NUMBER_LLONG:
+        return n.v.ll;
+    case NUMBER_BIGINT:
+        return bigint_to_double(n.v.big);
+    default:
+        return n.v.d;
     }
 }
 
-#define ARITH(FUNC_NAME, INT_OP, DBL_OP) \
-Number FUNC_NAME(Number a0, Number b0) { \
+char *format_number(Number n) {
+    char *str;
+    int len;
+
+    switch (n.type) {
+    case NUMBER_BIGINT:
+        return bigint_to_string(n.v.big);
+    case NUMBER_LLONG:
+        len = snprintf(NULL, 0, "%lld", n.v.ll);
+        str = malloc(len + 1);
+        sprintf(str, "%lld", n.v.ll);
+        return str;
+    default:
+        len = snprintf(NULL, 0, "%g", n.v.d);
+        str = malloc(len + 1);
+        sprintf(str, "%g", n.v.d);
+        return str;
+    }
+}
+
+// op on a and b, at least one of them a bigint and neither a double
+static Number big_arith(BigInt *(*op)(const BigInt *, const BigInt *), Number a, Number b) {
+    BigInt *x = a.type == NUMBER_BIGINT ? a.v.big : bigint_from_ll(a.v.ll);
+    BigInt *y = b.type == NUMBER_BIGINT ? b.v.big : bigint_from_ll(b.v.ll);
+    Number res = create_number_big(op(x, y));
+
+    if (x != a.v.big) free_bigint(x);
+    if (y != b.v.big) free_bigint(y);
+    return res;
+}
+
+// Small integers only take the first branch. Integers that overflow become
+// bigints, doubles are contagious.
+#define ARITH(FUNC_NAME, INT_OP, BIG_OP, DBL_OP) \
+Number FUNC_NAME(Number a, Number b) { \
     long long res; \
-    Number a, b; \
-    cast_types(a0, b0, &a, &b); \
     \
-    if (a.type == NUMBER_LLONG) { \
-        if (INT_OP(a.v.ll, b.v.ll, &res)) { \
-            /* overflow, use doubles */ \
-            a = create_number_d(a.v.ll); \
-            b = create_number_d(b.v.ll); \
-        } else { \
-            return create_number_ll(res); \
-        } \
+    if (a.type == NUMBER_LLONG && b.type == NUMBER_LLONG && !INT_OP(a.v.ll, b.v.ll, &res)) { \
+        return create_number_ll(res); \
     } \
-    \
-    return create_number_d(a.v.d DBL_OP b.v.d); \
+    if (a.type == NUMBER_DOUBLE || b.type == NUMBER_DOUBLE) { \
+        return create_number_d(number_to_double(a) DBL_OP number_to_double(b)); \
+    } \
+    return big_arith(BIG_OP, a, b); \
 }
 
-ARITH(add_number, __builtin_saddll_overflow, +)
-ARITH(sub_number, __builtin_ssubll_overflow, -)
-ARITH(mul_number, __builtin_smulll_overflow, *)
-
-Number div_number(Number a0, Number b0) {
-    Number a, b;
-    cast_types(a0, b0, &a, &b);
+ARITH(add_number, __builtin_saddll_overflow, bigint_add, +)
+ARITH(sub_number, __builtin_ssubll_overflow, bigint_sub, -)
+ARITH(mul_number, __builtin_smulll_overflow, bigint_mul, *)
 
-    if (a.type == NUMBER_LLONG) {
+Number div_number(Number a, Number b) {
+    if (a.type == NUMBER_LLONG && b.type == NUMBER_LLONG && b.v.ll != -1) {
         return create_number_ll(a.v.ll / b.v.ll);
-    } else {
-        return create_number_d(a.v.d / b.v.d);
     }
+    if (a.type == NUMBER_DOUBLE || b.type == NUMBER_DOUBLE) {
+        return create_number_d(number_to_double(a) / number_to_double(b));
+    }
+    // Dividing LLONG_MIN by -1 overflows too
+    return big_arith(bigint_div, a, b);
 }
 
-Number rem_number(Number a0, Number b0) {
-    Number a, b;
-    cast_types(a0, b0, &a, &b);
-
-    if (a.type == NUMBER_LLONG) {
-        return create_number_ll(a.v.ll % b.v.ll);
-    } else {
-        double res = a.v.d / b.v.d;
+Number rem_number(Number a, Number b) {
+    if (a.type == NUMBER_LLONG && b.type == NUMBER_LLONG) {
+        return create_number_ll(b.v.ll == -1 ? 0 : a.v.ll % b.v.ll);
+    }
+    if (a.type == NUMBER_DOUBLE || b.type == NUMBER_DOUBLE) {
+        double x = number_to_double(a), y = number_to_double(b);
+        double res = x / y;
         double decimal = res - floor(res);
-        return create_number_d(b.v.d * decimal);
+        return create_number_d(y * decimal);
     }
+    return big_arith(bigint_rem, a, b);
+}
+
+// Compares a and b, at least one of them a bigint and neither a double
+static int big_cmp(Number a, Number b) {
+    // Bigints are all outside the range of a long long
+    if (a.type != NUMBER_BIGINT) return b.v.big->neg ? 1 : -1;
+    if (b.type != NUMBER_BIGINT) return a.v.big->neg ? -1 : 1;
+    return bigint_cmp(a.v.big, b.v.big);
 }
 
 #define COMP(NAME, OP) \
-int NAME(Number a0, Number b0) { \
-    Number a, b; \
-    cast_types(a0, b0, &a, &b); \
-    \
-    if (a.type == NUMBER_LLONG) { \
+int NAME(Number a, Number b) { \
+    if (a.type == NUMBER_LLONG && b.type == NUMBER_LLONG) { \
         return a.v.ll OP b.v.ll; \
-    } else { \
-        return a.v.d OP b.v.d; \
     } \
+    if (a.type == NUMBER_DOUBLE || b.type == NUMBER_DOUBLE) { \
+        return number_to_double(a) OP number_to_double(b); \
+    } \
+    return big_cmp(a, b) OP 0; \
 }
 
 COMP(eq_number, ==)
 COMP(lt_number, <)
 COMP(lte_number, <=)
 
+// An integer number for x, which has no fraction
+static Number integer_number(double x) {
+    if (x >= -0x1p63 && x < 0x1p63) return create_number_ll(x);
+    if (isfinite(x)) return create_number_big(bigint_from_double(x));
+    return create_number_d(x);
+}
+
 Number floor_number(Number a) {
-    if (a.type == NUMBER_LLONG) {
-        return a;
+    if (a.type != NUMBER_DOUBLE) {
+        return copy_number(a);
     } else {
-        return create_number_ll(floor(a.v.d));
+        return integer_number(floor(a.v.d));
     }
 }
 
 Number ceil_number(Number a) {
-    if (a.type == NUMBER_LLONG) {
-        return a;
+    if (a.type != NUMBER_DOUBLE) {
+        return copy_number(a);
     } else {
-        return create_number_ll(ceil(a.v.d));
+        return integer_number(ceil(a.v.d));
     }
 }
@@ -1,32 +1,64 @@
 #ifndef NUMBER_H
 #define NUMBER_H
 
+#include "bigint.h"
+
 struct Number;
 typedef struct Number Number;
 
 enum Number_Type {
     NUMBER_LLONG,
     NUMBER_DOUBLE,
+    NUMBER_BIGINT, // only for integers that don't fit in a long long
 };
 
+// A NUMBER_BIGINT owns its digits. Numbers returned by the functions below
+// must be passed on to create_number() or freed with free_number(), while
+// number_of() only lends the one in a Value.
 struct Number {
     enum Number_Type type;
     union {
         long long ll;
         double d;
+        BigInt *big;
     } v;
 };
 
 Number create_number_ll(long long);
 Number create_number_d(double);
-Number parse_number(const char **);
+// Reads the number at *pstr, which goes no further than end, and moves
+// *pstr past it
+Number parse_number(const char **pstr, const char *end);
+
+// Takes over big, and frees it if the value fits in a long long
+Number create_number_big(BigInt *big);
+
+static inline Number copy_number(Number n) {
+    if (n.type == NUMBER_BIGINT) n.v.big = copy_bigint(n.v.big);
+    return n;
+}
+
+static inline void free_number(Number n) {
+    if (n.type == NUMBER_BIGINT) free_bigint(n.v.big);
+}
+
+double number_to_double(Number);
+
+// Decimal, malloc'ed
+char *format_number(Number);
 
 Number add_number(Number, Number);
 Number sub_number(Number, Number);
 Number mul_number(Number, Number);
+
+// Integer division by an exact 0 has no result, see divides_by_zero()
 Number div_number(Number, Number);
 Number rem_number(Number, Number);
 
+static inline int divides_by_zero(Number a, Number b) {
+    return a.type != NUMBER_DOUBLE && b.type == NUMBER_LLONG && b.v.ll == 0;
+}
+
 int eq_number(Number, Number);
 int lt_number(Number, Number);
 int lte_number(Number, Number);
@@ -0,0 +1,242 @@
+#include "numvector.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+// Whether any lane of x has its sign bit set
+#define ANY_SIGN(x) (_mm256_movemask_pd(_mm256_castsi256_pd(x)) != 0)
+#endif
+
+#define LANES 4
+
+void f64_add(double *r, const double *a, const double *b, size_t n) {
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i + LANES <= n; i += LANES) {
+        _mm256_storeu_pd(r + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+#endif
+    for (; i < n; i++) r[i] = a[i] + b[i];
+}
+
+void f64_mul(double *r, const double *a, const double *b, size_t n) {
+    size_t i = 0;
+#ifdef __AVX2__
+    for (; i + LANES <= n; i += LANES) {
+        _mm256_storeu_pd(r + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+#endif
+    for (; i < n; i++) r[i] = a[i] * b[i];
+}
+
+void f64_scale(double *r, const double *a, double k, size_t n) {
+    size_t i = 0;
+#ifdef __AVX2__
+    __m256d vk = _mm256_set1_pd(k);
+    for (; i + LANES <= n; i += LANES) {
+        _mm256_storeu_pd(r + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), vk));
+    }
+#endif
+    for (; i < n; i++) r[i] = a[i] * k;
+}
+
+double f64_sum(const double *a, size_t n) {
+    double acc[LANES] = { 0, 0, 0, 0 };
+    size_t i = 0;
+
+#ifdef __AVX2__
+    __m256d v = _mm256_setzero_pd();
+    for (; i + LANES <= n; i += LANES) v = _mm256_add_pd(v, _mm256_loadu_pd(a + i));
+    _mm256_storeu_pd(acc, v);
+#else
+    for (; i + LANES <= n; i += LANES) {
+        for (int j = 0; j < LANES; j++) acc[j] += a[i + j];
+    }
+#endif
+
+    double sum = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    for (; i < n; i++) sum += a[i];
+    return sum;
+}
+
+double f64_dot(const double *a, const double *b, size_t n) {
+    double acc[LANES] = { 0, 0, 0, 0 };
+    size_t i = 0;
+
+#ifdef __AVX2__
+    __m256d v = _mm256_setzero_pd();
+    for (; i + LANES <= n; i += LANES) {
+        v = _mm256_add_pd(v, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    _mm256_storeu_pd(acc, v);
+#else
+    for (; i + LANES <= n; i += LANES) {
+        for (int j = 0; j < LANES; j++) acc[j] += a[i + j] * b[i + j];
+    }
+#endif
+
+    double sum = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    for (; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+// The lanes keep x < m ? x : m, which is what _mm256_min_pd(x, m) does with
+// NaNs too
+double f64_min(const double *a, size_t n) {
+    double m = a[0];
+    size_t i = 0;
+
+    if (n >= LANES) {
+        double acc[LANES] = { a[0], a[1], a[2], a[3] };
+#ifdef __AVX2__
+        __m256d v = _mm256_loadu_pd(a);
+        for (i = LANES; i + LANES <= n; i += LANES) v = _mm256_min_pd(_mm256_loadu_pd(a + i), v);
+        _mm256_storeu_pd(acc, v);
+#else
+        for (i = LANES; i + LANES <= n; i += LANES) {
+            for (int j = 0; j < LANES; j++) acc[j] = a[i + j] < acc[j] ? a[i + j] : acc[j];
+        }
+#endif
+        m = acc[0];
+        for (int j = 1; j < LANES; j++) m = acc[j] < m ? acc[j] : m;
+    }
+    for (; i < n; i++) m = a[i] < m ? a[i] : m;
+    return m;
+}
+
+double f64_max(const double *a, size_t n) {
+    double m = a[0];
+    size_t i = 0;
+
+    if (n >= LANES) {
+        double acc[LANES] = { a[0], a[1], a[2], a[3] };
+#ifdef __AVX2__
+        __m256d v = _mm256_loadu_pd(a);
+        for (i = LANES; i + LANES <= n; i += LANES) v = _mm256_max_pd(_mm256_loadu_pd(a + i), v);
+        _mm256_storeu_pd(acc, v);
+#else
+        for (i = LANES; i + LANES <= n; i += LANES) {
+            for (int j = 0; j < LANES; j++) acc[j] = a[i + j] > acc[j] ? a[i + j] : acc[j];
+        }
+#endif
+        m = acc[0];
+        for (int j = 1; j < LANES; j++) m = acc[j] > m ? acc[j] : m;
+    }
+    for (; i < n; i++) m = a[i] > m ? a[i] : m;
+    return m;
+}
+
+int s64_add(int64_t *r, const int64_t *a, const int64_t *b, size_t n) {
+    size_t i = 0;
+    int overflow = 0;
+
+#ifdef __AVX2__
+    // A sum overflows when its sign differs from that of both operands
+    __m256i signs = _mm256_setzero_si256();
+    for (; i + LANES <= n; i += LANES) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i s = _mm256_add_epi64(x, y);
+        signs = _mm256_or_si256(signs, _mm256_and_si256(_mm256_xor_si256(x, s), _mm256_xor_si256(y, s)));
+        _mm256_storeu_si256((__m256i *)(r + i), s);
+    }
+    overflow = ANY_SIGN(signs);
+#endif
+    for (; i < n; i++) overflow |= __builtin_add_overflow(a[i], b[i], &r[i]);
+    return !overflow;
+}
+
+// AVX2 has no 64 bit multiply, these are scalar
+int s64_mul(int64_t *r, const int64_t *a, const int64_t *b, size_t n) {
+    int overflow = 0;
+    for (size_t i = 0; i < n; i++) overflow |= __builtin_mul_overflow(a[i], b[i], &r[i]);
+    return !overflow;
+}
+
+int s64_scale(int64_t *r, const int64_t *a, int64_t k, size_t n) {
+    int overflow = 0;
+    for (size_t i = 0; i < n; i++) overflow |= __builtin_mul_overflow(a[i], k, &r[i]);
+    return !overflow;
+}
+
+int s64_sum(const int64_t *a, size_t n, int64_t *sum) {
+    int64_t acc[LANES] = { 0, 0, 0, 0 };
+    size_t i = 0;
+    int overflow = 0;
+
+#ifdef __AVX2__
+    __m256i v = _mm256_setzero_si256(), signs = _mm256_setzero_si256();
+    for (; i + LANES <= n; i += LANES) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i s = _mm256_add_epi64(v, x);
+        signs = _mm256_or_si256(signs, _mm256_and_si256(_mm256_xor_si256(v, s), _mm256_xor_si256(x, s)));
+        v = s;
+    }
+    _mm256_storeu_si256((__m256i *)acc, v);
+    overflow = ANY_SIGN(signs);
+#else
+    for (; i + LANES <= n; i += LANES) {
+        for (int j = 0; j < LANES; j++) overflow |= __builtin_add_overflow(acc[j], a[i + j], &acc[j]);
+    }
+#endif
+
+    // The partial sums can overflow when the total doesn't, the caller then
+    // adds them up exactly
+    int64_t s = 0;
+    for (int j = 0; j < LANES; j++) overflow |= __builtin_add_overflow(s, acc[j], &s);
+    for (; i < n; i++) overflow |= __builtin_add_overflow(s, a[i], &s);
+    *sum = s;
+    return !overflow;
+}
+
+int s64_dot(const int64_t *a, const int64_t *b, size_t n, int64_t *dot) {
+    int64_t s = 0, p;
+    int overflow = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        overflow |= __builtin_mul_overflow(a[i], b[i], &p);
+        overflow |= __builtin_add_overflow(s, p, &s);
+    }
+    *dot = s;
+    return !overflow;
+}
+
+int64_t s64_min(const int64_t *a, size_t n) {
+    int64_t m = a[0];
+    size_t i = 0;
+
+#ifdef __AVX2__
+    if (n >= LANES) {
+        int64_t acc[LANES];
+        __m256i v = _mm256_loadu_si256((const __m256i *)a);
+        for (i = LANES; i + LANES <= n; i += LANES) {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+            v = _mm256_blendv_epi8(v, x, _mm256_cmpgt_epi64(v, x));
+        }
+        _mm256_storeu_si256((__m256i *)acc, v);
+        for (int j = 0; j < LANES; j++) m = acc[j] < m ? acc[j] : m;
+    }
+#endif
+    for (; i < n; i++) m = a[i] < m ? a[i] : m;
+    return m;
+}
+
+int64_t s64_max(const int64_t *a, size_t n) {
+    int64_t m = a[0];
+    size_t i = 0;
+
+#ifdef __AVX2__
+    if (n >= LANES) {
+        int64_t acc[LANES];
+        __m256i v = _mm256_loadu_si256((const __m256i *)a);
+        for (i = LANES; i + LANES <= n; i += LANES) {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+            v = _mm256_blendv_epi8(v, x, _mm256_cmpgt_epi64(x, v));
+        }
+        _mm256_storeu_si256((__m256i *)acc, v);
+        for (int j = 0; j < LANES; j++) m = acc[j] > m ? acc[j] : m;
+    }
+#endif
+    for (; i < n; i++) m = a[i] > m ? a[i] : m;
+    return m;
+}
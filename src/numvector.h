@@ -0,0 +1,33 @@
+#ifndef NUMVECTOR_H
+#define NUMVECTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Kernels for the bulk operations on f64vectors and s64vectors, which work
+// on 4 items at a time with AVX2 where the build targets it. Reductions keep
+// 4 partial results and combine them in the same order either way, so a
+// build without AVX2 gives the same sums.
+
+void f64_add(double *r, const double *a, const double *b, size_t n);
+void f64_mul(double *r, const double *a, const double *b, size_t n);
+void f64_scale(double *r, const double *a, double k, size_t n);
+double f64_sum(const double *a, size_t n);
+double f64_dot(const double *a, const double *b, size_t n);
+
+// n must not be 0
+double f64_min(const double *a, size_t n);
+double f64_max(const double *a, size_t n);
+
+// These return 0 if a result may not fit in 64 bits
+int s64_add(int64_t *r, const int64_t *a, const int64_t *b, size_t n);
+int s64_mul(int64_t *r, const int64_t *a, const int64_t *b, size_t n);
+int s64_scale(int64_t *r, const int64_t *a, int64_t k, size_t n);
+int s64_sum(const int64_t *a, size_t n, int64_t *sum);
+int s64_dot(const int64_t *a, const int64_t *b, size_t n, int64_t *dot);
+
+// n must not be 0
+int64_t s64_min(const int64_t *a, size_t n);
+int64_t s64_max(const int64_t *a, size_t n);
+
+#endif
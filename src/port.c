@@ -0,0 +1,303 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "port.h"
+
+#ifdef __unix__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+Port stdout_port = { .fd = 1 };
+Port *current_output = &stdout_port;
+Port stdin_port = { .fd = 0, .flags = PORT_INPUT };
+
+// The open output file ports, stdout among them, for flush_outputs
+static Port *outputs = &stdout_port;
+
+static void flush_outputs(void) {
+    for (Port *port = outputs; port != NULL; port = port->next) flush_port(port);
+}
+
+// Registered when stdout is first written to or a file is opened
+static void flush_at_exit(void) {
+    static int registered;
+    if (!registered) {
+        atexit(flush_outputs);
+        registered = 1;
+    }
+}
+
+static void add_output(Port *port) {
+    flush_at_exit();
+    port->prev = NULL;
+    port->next = outputs;
+    if (outputs != NULL) outputs->prev = port;
+    outputs = port;
+}
+
+static void remove_output(Port *port) {
+    if (port->prev != NULL) {
+        port->prev->next = port->next;
+    } else if (outputs == port) {
+        outputs = port->next;
+    } else {
+        return; // not in the list
+    }
+    if (port->next != NULL) port->next->prev = port->prev;
+    port->prev = port->next = NULL;
+}
+
+// File ports get their buffer when first written to, so stdout costs
+// nothing until it is used
+static void start_buffer(Port *port) {
+    port->size = PORT_BUFFER_SIZE;
+    port->buf = malloc(port->size);
+
+    if (port == &stdin_port) {
+#ifndef __unix__
+        port->file = stdin;
+#endif
+        port->buf[0] = 0;
+    } else if (port == &stdout_port) {
+#ifdef __unix__
+        if (isatty(port->fd)) port->flags |= PORT_LINE;
+#else
+        port->file = stdout;
+#endif
+        flush_at_exit();
+    }
+}
+
+static Port *create_port(int fd, int flags, size_t size) {
+    Port *port = calloc(1, sizeof *port);
+    port->fd = fd;
+    port->flags = flags;
+    port->size = size;
+    port->buf = malloc(size);
+    return port;
+}
+
+Port *open_output_file(const char *path) {
+#ifdef __unix__
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) return NULL;
+    Port *port = create_port(fd, 0, PORT_BUFFER_SIZE);
+#else
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) return NULL;
+
+    Port *port = create_port(0, 0, PORT_BUFFER_SIZE);
+    port->file = file;
+#endif
+    add_output(port);
+    return port;
+}
+
+Port *open_output_string(void) {
+    return create_port(-1, PORT_STRING, 64);
+}
+
+Port *open_input_file(const char *path) {
+#ifdef __unix__
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    Port *port = create_port(fd, PORT_INPUT, PORT_BUFFER_SIZE);
+#else
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    Port *port = create_port(0, PORT_INPUT, PORT_BUFFER_SIZE);
+    port->file = file;
+#endif
+    port->buf[0] = 0;
+    return port;
+}
+
+Port *open_input_string(const char *chars, size_t len) {
+    Port *port = create_port(-1, PORT_INPUT | PORT_STRING, len + 1);
+    memcpy(port->buf, chars, len);
+    port->buf[len] = 0;
+    port->len = len;
+    return port;
+}
+
+// Writes out len bytes, returns 0 on success
+static int write_bytes(Port *port, const char *bytes, size_t len) {
+#ifdef __unix__
+    while (len > 0) {
+        ssize_t n = write(port->fd, bytes, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        bytes += n;
+        len -= n;
+    }
+    return 0;
+#else
+    return fwrite(bytes, 1, len, port->file) == len ? 0 : -1;
+#endif
+}
+
+int flush_port(Port *port) {
+    if (port->flags & (PORT_STRING | PORT_CLOSED | PORT_INPUT) || port->len == 0) return 0;
+
+    int ret = write_bytes(port, port->buf, port->len);
+    port->len = 0;
+    return ret;
+}
+
+int close_port(Port *port) {
+    if (port->flags & PORT_CLOSED) return 0;
+
+    int ret = flush_port(port);
+    remove_output(port);
+    if (!(port->flags & PORT_STRING) && port != &stdout_port && port != &stdin_port) {
+#ifdef __unix__
+        if (close(port->fd)) ret = -1;
+#else
+        if (fclose(port->file)) ret = -1;
+#endif
+    }
+    port->flags |= PORT_CLOSED;
+    return ret;
+}
+
+void free_port(Port *port) {
+    close_port(port);
+    free(port->buf);
+    free(port);
+}
+
+size_t read_port_bytes(Port *port, char *dst, size_t max) {
+    if (port->flags & (PORT_STRING | PORT_CLOSED)) return 0;
+#ifdef __unix__
+    for (;;) {
+        ssize_t n = read(port->fd, dst, max);
+        if (n < 0 && errno == EINTR) continue;
+        return n < 0 ? 0 : n;
+    }
+#else
+    return fread(dst, 1, max, port->file);
+#endif
+}
+
+// Reads until at least n bytes from pos are in the buffer or the file ends.
+// Returns how many there are.
+static size_t fill_port(Port *port, size_t n) {
+    if (port->buf == NULL) start_buffer(port);
+
+    while (port->len - port->pos < n && !(port->flags & (PORT_STRING | PORT_CLOSED))) {
+        memmove(port->buf, port->buf + port->pos, port->len - port->pos);
+        port->len -= port->pos;
+        port->pos = 0;
+
+        if (port->len + 1 >= port->size) {
+            port->size *= 2;
+            port->buf = realloc(port->buf, port->size);
+        }
+
+        size_t got = read_port_bytes(port, port->buf + port->len, port->size - port->len - 1);
+        port->len += got;
+        port->buf[port->len] = 0;
+        if (got == 0) break;
+    }
+
+    return port->len - port->pos;
+}
+
+int port_getc(Port *port) {
+    if (port->pos < port->len || fill_port(port, 1)) {
+        return (unsigned char)port->buf[port->pos++];
+    }
+    return -1;
+}
+
+int port_peekc(Port *port) {
+    if (port->pos < port->len || fill_port(port, 1)) {
+        return (unsigned char)port->buf[port->pos];
+    }
+    return -1;
+}
+
+const char *port_read_line(Port *port, size_t *len) {
+    size_t scanned = 0;
+    if (port->buf == NULL) start_buffer(port);
+
+    for (;;) {
+        const char *start = port->buf + port->pos;
+        size_t avail = port->len - port->pos;
+        const char *nl = memchr(start + scanned, '\n', avail - scanned);
+
+        if (nl != NULL) {
+            *len = nl - start;
+            port->pos += *len + 1;
+            return start;
+        }
+
+        // A line without a newline ends the file
+        scanned = avail;
+        if (fill_port(port, avail + 1) == avail) {
+            if (avail == 0) return NULL;
+            *len = avail;
+            port->pos = port->len;
+            return port->buf + port->len - avail;
+        }
+    }
+}
+
+void port_write(Port *port, const char *bytes, size_t len) {
+    if (port->flags & PORT_CLOSED) return;
+    if (port->buf == NULL) start_buffer(port);
+
+    if (port->len + len > port->size) {
+        if (port->flags & PORT_STRING) {
+            while (port->len + len > port->size) port->size *= 2;
+            port->buf = realloc(port->buf, port->size);
+        } else {
+            flush_port(port);
+
+            // Too big to be worth buffering
+            if (len >= port->size) {
+                write_bytes(port, bytes, len);
+                return;
+            }
+        }
+    }
+
+    memcpy(port->buf + port->len, bytes, len);
+    port->len += len;
+
+    if (port->flags & PORT_LINE && memchr(bytes, '\n', len)) flush_port(port);
+}
+
+void port_puts(Port *port, const char *str) {
+    port_write(port, str, strlen(str));
+}
+
+void port_printf(Port *port, const char *tmpl, ...) {
+    char small[64];
+    va_list args;
+
+    // Formatted straight into the buffer when it fits
+    va_start(args, tmpl);
+    size_t room = port->size - port->len;
+    int len = vsnprintf(room ? port->buf + port->len : small, room ? room : sizeof small, tmpl, args);
+    va_end(args);
+    if (len < 0) return;
+
+    if ((size_t)len < room && !(port->flags & (PORT_LINE | PORT_CLOSED))) {
+        port->len += len;
+        return;
+    }
+
+    char *text = (size_t)len < sizeof small ? small : malloc(len + 1);
+    va_start(args, tmpl);
+    vsnprintf(text, len + 1, tmpl, args);
+    va_end(args);
+
+    port_write(port, text, len);
+    if (text != small) free(text);
+}
@@ -0,0 +1,86 @@
+#ifndef PORT_H
+#define PORT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Output ports collect what is written to them in a buffer. File ports pass
+// it on to the system a buffer at a time, or a line at a time when writing
+// to a terminal; string ports keep all of it for get-output-string.
+//
+// Input ports read their file a buffer at a time. Lines, and the text of
+// datums being parsed, are read in place in the buffer, which only grows for
+// a line longer than it.
+
+#define PORT_STRING 1 // no file, the buffer grows instead
+#define PORT_LINE   2 // flushed at each newline
+#define PORT_CLOSED 4
+#define PORT_INPUT  8
+
+#define PORT_BUFFER_SIZE 65536
+
+typedef struct Port {
+    int fd; // -1 for string ports
+    int flags;
+#ifndef __unix__
+    FILE *file; // in place of fd
+#endif
+    char *buf; // for input, the bytes up to len are followed by a NUL
+    size_t len, size;
+    size_t pos; // for input, the next byte in buf
+    struct Port *prev, *next; // among the open output file ports
+} Port;
+
+// Where print, display, write and newline go by default: stdout, or the
+// string port of the innermost with-output-to-string
+extern Port *current_output;
+extern Port stdout_port;
+
+// What read-line, read-char, peek-char and read read by default
+extern Port stdin_port;
+
+// Returns NULL if path can't be opened for writing
+Port *open_output_file(const char *path);
+Port *open_output_string(void);
+
+// Returns NULL if path can't be opened for reading
+Port *open_input_file(const char *path);
+
+// A port reading a copy of the len bytes at chars
+Port *open_input_string(const char *chars, size_t len);
+
+// Output file ports still open when the program exits are flushed then.
+
+// Flushes and closes port, but doesn't free it. Returns 0 if everything
+// written got to the file.
+int close_port(Port *port);
+void free_port(Port *port);
+
+// Passes on what has been written to port so far. Returns 0 on success.
+int flush_port(Port *port);
+
+// Reads up to max bytes from the file of port into dst. Returns 0 at its end
+// or for a string port, which has all its text in the buffer from the start.
+size_t read_port_bytes(Port *port, char *dst, size_t max);
+
+// The next byte of port, or -1 at its end. port_getc() moves past it.
+int port_getc(Port *port);
+int port_peekc(Port *port);
+
+// The next line of port, without its newline, and its length in *len. It is
+// in the buffer of port, valid until port is read again. NULL at the end.
+const char *port_read_line(Port *port, size_t *len);
+
+void port_write(Port *port, const char *bytes, size_t len);
+void port_puts(Port *port, const char *str);
+void port_printf(Port *port, const char *tmpl, ...);
+
+static inline void port_putc(Port *port, char ch) {
+    if (port->len < port->size && !(port->flags & PORT_LINE)) {
+        port->buf[port->len++] = ch;
+    } else {
+        port_write(port, &ch, 1);
+    }
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include "scan.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+#define BLOCK 16
+
+// Index of the first character of the block that isn't of the kind in mask
+#define FIRST_OUTSIDE(mask) __builtin_ctz(~(unsigned)_mm_movemask_epi8(mask))
+#define ALL_INSIDE(mask) (_mm_movemask_epi8(mask) == 0xffff)
+#endif
+
+static inline int is_space(unsigned char ch) {
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+// isgraph() in the C locale, but for the parentheses
+static inline int is_token(unsigned char ch) {
+    return ch > ' ' && ch < 127 && ch != '(' && ch != ')';
+}
+
+static inline int is_string(unsigned char ch) {
+    return ch != '"' && ch != '\\' && ch != 0;
+}
+
+size_t span_space(const char *p, size_t n) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + BLOCK <= n; i += BLOCK) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i m = _mm_or_si128(
+                _mm_cmpeq_epi8(c, _mm_set1_epi8(' ')),
+                _mm_and_si128(
+                    _mm_cmpgt_epi8(c, _mm_set1_epi8('\t' - 1)),
+                    _mm_cmplt_epi8(c, _mm_set1_epi8('\r' + 1))));
+        if (!ALL_INSIDE(m)) return i + FIRST_OUTSIDE(m);
+    }
+#endif
+
+    while (i < n && is_space(p[i])) i++;
+    return i;
+}
+
+size_t span_token(const char *p, size_t n) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + BLOCK <= n; i += BLOCK) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(p + i));
+        // Bytes from 128 on are negative, so they aren't above ' '
+        __m128i graph = _mm_cmpgt_epi8(c, _mm_set1_epi8(' '));
+        __m128i other = _mm_or_si128(
+                _mm_cmpeq_epi8(c, _mm_set1_epi8(127)),
+                _mm_or_si128(
+                    _mm_cmpeq_epi8(c, _mm_set1_epi8('(')),
+                    _mm_cmpeq_epi8(c, _mm_set1_epi8(')'))));
+        __m128i m = _mm_andnot_si128(other, graph);
+        if (!ALL_INSIDE(m)) return i + FIRST_OUTSIDE(m);
+    }
+#endif
+
+    while (i < n && is_token(p[i])) i++;
+    return i;
+}
+
+size_t span_string(const char *p, size_t n) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + BLOCK <= n; i += BLOCK) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i stop = _mm_or_si128(
+                _mm_cmpeq_epi8(c, _mm_set1_epi8('"')),
+                _mm_or_si128(
+                    _mm_cmpeq_epi8(c, _mm_set1_epi8('\\')),
+                    _mm_cmpeq_epi8(c, _mm_setzero_si128())));
+        int bits = _mm_movemask_epi8(stop);
+        if (bits) return i + __builtin_ctz(bits);
+    }
+#endif
+
+    while (i < n && is_string(p[i])) i++;
+    return i;
+}
@@ -0,0 +1,19 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+// Scanners the reader uses to find the end of a run of characters. Each
+// returns the length of the longest prefix of the n characters at p that are
+// all of its kind, looking at 16 of them at a time where SSE2 is available.
+
+// Whitespace
+size_t span_space(const char *p, size_t n);
+
+// Characters of an atom or number, up to whitespace or a parenthesis
+size_t span_token(const char *p, size_t n);
+
+// Characters of a string literal, up to a quote, a backslash or a NUL
+size_t span_string(const char *p, size_t n);
+
+#endif
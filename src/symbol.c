@@ -0,0 +1,55 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "symbol.h"
+
+#define INITIAL_SIZE 256
+
+// Open addressing table of interned atoms, size is always a power of two
+static Value **table = NULL;
+static size_t table_size = 0;
+static size_t table_count = 0;
+
+static void grow(void) {
+    Value **old = table;
+    size_t old_size = table_size;
+
+    table_size = old_size ? old_size << 1 : INITIAL_SIZE;
+    table = calloc(table_size, sizeof *table);
+
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i] == NULL) continue;
+
+        const char *name = old[i]->value.atom;
+        size_t j = hash_bytes(name, strlen(name)) & (table_size - 1);
+        while (table[j] != NULL) j = (j + 1) & (table_size - 1);
+        table[j] = old[i];
+    }
+
+    free(old);
+}
+
+Value *intern_n(const char *name, size_t len) {
+    if ((table_count + 1) * 2 > table_size) grow();
+
+    size_t i = hash_bytes(name, len) & (table_size - 1);
+
+    while (table[i] != NULL) {
+        const char *other = table[i]->value.atom;
+        if (!strncmp(other, name, len) && other[len] == 0) {
+            return table[i];
+        }
+        i = (i + 1) & (table_size - 1);
+    }
+
+    Value *v = create_value(TYPE_ATOM); // Lives forever
+    v->value.atom = strndup(name, len);
+
+    table[i] = v;
+    table_count += 1;
+    return v;
+}
+
+Value *intern(const char *name) {
+    return intern_n(name, strlen(name));
+}
@@ -0,0 +1,12 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <stddef.h>
+#include "value.h"
+
+// Atoms are interned: there is exactly one atom Value per name, so atoms (and
+// environment names) can be compared by pointer. Interned atoms are never freed.
+Value *intern(const char *name);
+Value *intern_n(const char *name, size_t len);
+
+#endif
@@ -3,7 +3,12 @@
 #include <string.h>
 #include <stdarg.h>
 #include <assert.h>
+#include "alloc.h"
+#include "gc.h"
 #include "value.h"
+#include "symbol.h"
+#include "vm.h"
+#include "hashtable.h"
 
 const char *type_names[] = {
     "null",
@@ -18,85 +23,180 @@ const char *type_names[] = {
     "exception*",
     "exception",
     "string",
+    "char",
+    "macro",
+    "vector",
+    "hash-table",
+    "f64vector",
+    "s64vector",
+    "port",
+    "bytevector",
+    "eof-object",
+    "environment",
 };
 
-Value vtrue = {
-    .type = TYPE_BOOLEAN,
-    .value.boolean = 1,
-    .refs = 1,
-    .gc_next = NULL,
-    .gc_prev = NULL,
-};
-
-Value vfalse = {
-    .type = TYPE_BOOLEAN,
-    .value.boolean = 0,
-    .refs = 1,
-    .gc_next = NULL,
-    .gc_prev = NULL,
-};
-
-Value *gc_head = NULL;
+Value eof_object = { .type = TYPE_EOF, .refs = 1 };
 
 Value *create_value(enum Type type) {
-    Value *v = calloc(1, sizeof *v);
+    gc_maybe_collect();
+
+    Value *v = slab_alloc(sizeof *v);
+    memset(v, 0, sizeof *v);
     v->type = type;
     v->refs = 1;
-    track_value(v);
     return v;
 }
 
-void track_value(Value *v) {
-    if (gc_head) gc_head->gc_prev = v;
-    v->gc_next = gc_head;
-    v->gc_prev = NULL;
-    gc_head = v;
-}
-
-int is_tracked(Value *v) {
-    return v->gc_prev || v->gc_next || v == gc_head;
-}
-
-void untrack_value(Value *v) {
-    if (v != NULL) {
-        if (v == gc_head) gc_head = v->gc_next;
-        if (v->gc_prev) {
-            v->gc_prev->gc_next = v->gc_next;
-            v->gc_prev = NULL;
-        }
-        if (v->gc_next) {
-            v->gc_next->gc_prev = v->gc_prev;
-            v->gc_next = NULL;
-        }
+Value *create_number(Number n) {
+    if (n.type == NUMBER_LLONG && n.v.ll >= FIXNUM_MIN && n.v.ll <= FIXNUM_MAX) {
+        return FIXNUM(n.v.ll);
     }
-}
 
-Value *create_number(Number n) {
     Value *v = create_value(TYPE_NUMBER);
     v->value.number = n;
     return v;
 }
 
 Value *create_atom(const char *str) {
-    return create_atom_alloced(strdup(str));
+    return intern(str);
 }
 
+// Takes ownership of str
 Value *create_atom_alloced(char *str) {
-    Value *v = create_value(TYPE_ATOM);
-    v->value.atom = str;
+    Value *v = intern(str);
+    free(str);
     return v;
 }
 
-Value *create_string(char *str) {
-    return create_string_alloced(strdup(str));
+// A buffer for size bytes. They start in the same block as the StrBuf.
+static struct StrBuf *create_strbuf(size_t size) {
+    struct StrBuf *buf = malloc(sizeof *buf + size + 1);
+    buf->data = (char *)(buf + 1);
+    buf->used = 0;
+    buf->size = size;
+    buf->refs = 1;
+    return buf;
 }
 
-Value *create_string_alloced(char *str) {
+static void release_strbuf(struct StrBuf *buf) {
+    if (--buf->refs) return;
+    if (buf->data != (char *)(buf + 1)) free(buf->data);
+    free(buf);
+}
+
+// Takes ownership of buf
+static Value *string_in(struct StrBuf *buf, size_t start, size_t len) {
     Value *v = create_value(TYPE_STRING);
-    v->value.string = str;
+    v->value.string.buf = buf;
+    v->value.string.start = start;
+    v->value.string.len = len;
     return v;
 }
 
+Value *create_string_len(const char *chars, size_t len) {
+    struct StrBuf *buf = create_strbuf(len);
+    memcpy(buf->data, chars, len);
+    buf->data[len] = 0;
+    buf->used = len;
+    return string_in(buf, 0, len);
+}
+
+Value *create_string(const char *str) {
+    return create_string_len(str, strlen(str));
+}
+
+// Takes ownership of str
+Value *create_string_alloced(char *str) {
+    Value *v = create_string(str);
+    free(str);
+    return v;
+}
+
+Value *reuse_string(Value *s, const char *chars, size_t len) {
+    if (s == NULL || s->refs != 1 || s->value.string.buf->refs != 1) {
+        delete_value(s);
+        return create_string_len(chars, len);
+    }
+
+    struct StrBuf *buf = s->value.string.buf;
+    if (len > buf->size) {
+        size_t size = buf->size * 2 > len ? buf->size * 2 : len;
+        if (buf->data != (char *)(buf + 1)) free(buf->data);
+        buf->data = malloc(size + 1);
+        buf->size = size;
+    }
+
+    memcpy(buf->data, chars, len);
+    buf->data[len] = 0;
+    buf->used = len;
+    s->value.string.start = 0;
+    s->value.string.len = len;
+    return s;
+}
+
+Value *create_substring(Value *s, size_t start, size_t len) {
+    s->value.string.buf->refs++;
+    return string_in(s->value.string.buf, s->value.string.start + start, len);
+}
+
+Value *concat_strings(Value *ls) {
+    size_t len = 0;
+    for (Value *p = ls; p != NULL; p = cdr(p)) len += string_len(car(p));
+    if (ls == NULL) return create_string_len("", 0);
+
+    struct String *first = &car(ls)->value.string;
+    struct StrBuf *buf = first->buf;
+    size_t start = first->start;
+
+    if (start + first->len == buf->used && start + len <= buf->size) {
+        // The first string ends the used bytes and there's room after it
+        buf->refs++;
+    } else if (start + first->len == buf->used) {
+        // Grow the buffer in place, everything sharing it refers by offset
+        size_t size = buf->size * 2;
+        if (size < start + len) size = start + len;
+
+        if (buf->data == (char *)(buf + 1)) {
+            buf->data = malloc(size + 1);
+            memcpy(buf->data, buf + 1, buf->used + 1);
+        } else {
+            buf->data = realloc(buf->data, size + 1);
+        }
+        buf->size = size;
+        buf->refs++;
+    } else {
+        buf = create_strbuf(len < 16 ? 16 : len);
+        memcpy(buf->data, string_chars(car(ls)), first->len);
+        buf->used = first->len;
+        start = 0;
+    }
+
+    for (Value *p = cdr(ls); p != NULL; p = cdr(p)) {
+        memcpy(buf->data + buf->used, string_chars(car(p)), string_len(car(p)));
+        buf->used += string_len(car(p));
+    }
+    buf->data[buf->used] = 0;
+
+    return string_in(buf, start, len);
+}
+
+const char *string_cstr(Value *s) {
+    struct String *str = &s->value.string;
+
+    if (str->start + str->len != str->buf->used) {
+        struct StrBuf *buf = create_strbuf(str->len);
+        memcpy(buf->data, string_chars(s), str->len);
+        buf->data[str->len] = 0;
+        buf->used = str->len;
+
+        release_strbuf(str->buf);
+        str->buf = buf;
+        str->start = 0;
+    }
+
+    return string_chars(s);
+}
+
 // Doesn't incr ref counter
 Value *cons(Value *h, Value *t) {
     Value *ls = create_value(TYPE_LIST);
@@ -157,49 +257,173 @@ Value *create_exception(const char *tmpl, ...) {
     return v;
 }
 
+Value *create_vector(size_t len, Value *fill) {
+    Value *v = create_value(TYPE_VECTOR);
+    v->value.vector.items = malloc(len * sizeof(Value *));
+    v->value.vector.len = len;
+
+    for (size_t i = 0; i < len; i++) {
+        v->value.vector.items[i] = copy_value(fill);
+    }
+    return v;
+}
+
+Value *list_to_vector(Value *ls) {
+    size_t len = 0;
+    for (Value *it = ls; it != NULL; it = cdr(it)) len++;
+
+    Value *v = create_vector(len, NULL);
+    for (size_t i = 0; i < len; i++, ls = cdr(ls)) {
+        v->value.vector.items[i] = copy_value(car(ls));
+    }
+    return v;
+}
+
+Value *create_numvector(enum Type type, size_t len) {
+    Value *v = create_value(type);
+    // Both kinds of item are 8 bytes
+    v->value.numvector.f64 = calloc(len, sizeof(double));
+    v->value.numvector.len = len;
+    return v;
+}
+
+static Value *bytes_in(struct ByteBuf *buf, size_t start, size_t len) {
+    Value *v = create_value(TYPE_BYTEVECTOR);
+    v->value.bytevector.buf = buf;
+    v->value.bytevector.start = start;
+    v->value.bytevector.len = len;
+    return v;
+}
+
+Value *create_bytevector(size_t len) {
+    struct ByteBuf *buf = malloc(sizeof *buf);
+    buf->data = calloc(len ? len : 1, 1);
+    buf->size = len;
+    buf->refs = 1;
+    buf->mapped = 0;
+    return bytes_in(buf, 0, len);
+}
+
+Value *map_bytevector(const void *data, size_t size) {
+    struct ByteBuf *buf = malloc(sizeof *buf);
+    buf->data = (unsigned char *)data;
+    buf->size = size;
+    buf->refs = 1;
+    buf->mapped = 1;
+    return bytes_in(buf, 0, size);
+}
+
+Value *create_byteslice(Value *bv, size_t start, size_t len) {
+    bv->value.bytevector.buf->refs++;
+    return bytes_in(bv->value.bytevector.buf, bv->value.bytevector.start + start, len);
+}
+
+static void release_bytebuf(struct ByteBuf *buf) {
+    if (--buf->refs) return;
+    if (buf->mapped) {
+        unmap_file(buf->data, buf->size);
+    } else {
+        free(buf->data);
+    }
+    free(buf);
+}
+
 Value *copy_value(Value *v) {
-    if (v != NULL) v->refs += 1;
+    if (IS_HEAP(v) && v->type != TYPE_ATOM) v->refs += 1;
     return v;
 }
 
 int delete_value(Value *v) {
-    if (v == NULL) return 0;
+    if (!IS_HEAP(v)) return 0;
+    if (v->type == TYPE_ATOM) return v->refs; // Interned, see symbol.c
+
+    if (--v->refs) return v->refs;
 
-    if (!--v->refs) {
-        untrack_value(v);
+    // Follow cdrs in a loop so long lists don't use up the stack
+    while (v != NULL) {
+        Value *next = NULL;
 
-        if (v->type == TYPE_LIST) {
+        switch (v->type) {
+        case TYPE_LIST:
             delete_value(v->value.list.car);
-            delete_value(v->value.list.cdr);
-        } else if (v->type == TYPE_ATOM) {
-            free(v->value.atom);
-        } else if (v->type == TYPE_EXCEPTION) {
+            next = v->value.list.cdr;
+            break;
+        case TYPE_FUNCTION:
+        case TYPE_FUNCTION_SF:
+        case TYPE_MACRO:
+            delete_value(v->value.func.operands);
+            delete_value(v->value.func.body);
+            if (v->value.func.env) delete_env(v->value.func.env);
+            if (v->value.func.code) release_code(v->value.func.code);
+            break;
+        case TYPE_EXCEPTION:
+        case TYPE_BOUND_EXCEPTION:
             free(v->value.exception);
+            break;
+        case TYPE_NUMBER:
+            free_number(v->value.number);
+            break;
+        case TYPE_STRING:
+            release_strbuf(v->value.string.buf);
+            break;
+        case TYPE_VECTOR:
+            for (size_t i = 0; i < v->value.vector.len; i++) {
+                delete_value(v->value.vector.items[i]);
+            }
+            free(v->value.vector.items);
+            break;
+        case TYPE_HASHTABLE:
+            free_hashtable(v->value.hashtable);
+            break;
+        case TYPE_F64VECTOR:
+        case TYPE_S64VECTOR:
+            free(v->value.numvector.f64);
+            break;
+        case TYPE_PORT:
+            free_port(v->value.port);
+            break;
+        case TYPE_BYTEVECTOR:
+            release_bytebuf(v->value.bytevector.buf);
+            break;
+        default:
+            break;
         }
-        free(v);
-        return 0;
+        slab_free(v);
+
+        // Dotted pairs can end in anything
+        if (!IS_HEAP(next) || next->type == TYPE_ATOM || --next->refs) break;
+        v = next;
     }
 
-    return v->refs;
+    return 0;
 }
 
 int values_equal(Value *a, Value *b) {
+    if (a == b) return 1;
+    if (TYPEOF(a) != TYPEOF(b)) return 0;
 
-    if (a->type != b->type) return 0;
-
-    switch (a->type) {
+    switch (TYPEOF(a)) {
     case TYPE_ATOM:
-        return !strcmp(a->value.atom, b->value.atom);
+        return a == b;
     case TYPE_STRING:
-        return !strcmp(a->value.string, b->value.string);
+        return string_len(a) == string_len(b)
+            && !memcmp(string_chars(a), string_chars(b), string_len(a));
     case TYPE_NUMBER:
-        return eq_number(a->value.number, b->value.number);
+        return eq_number(number_of(a), number_of(b));
     case TYPE_BOOLEAN:
-        return a->value.boolean == b->value.boolean;
+    case TYPE_CHAR:
+        return 0; // Immediates, equal only if identical
     case TYPE_LIST:
-        return values_equal(car(a), car(b)) && values_equal(car(a), car(b));
+        // Loop over the cdrs so long lists don't use up the stack
+        while (TYPEOF(a) == TYPE_LIST && TYPEOF(b) == TYPE_LIST) {
+            if (!values_equal(CAR(a), CAR(b))) return 0;
+            a = CDR(a);
+            b = CDR(b);
+        }
+        return values_equal(a, b);
     case TYPE_FUNCTION:
     case TYPE_FUNCTION_SF:
+    case TYPE_MACRO:
         // FIXME different parameters?
         return values_equal(a->value.func.operands, b->value.func.operands)
             && values_equal(a->value.func.body, b->value.func.body)
@@ -210,8 +434,33 @@ int values_equal(Value *a, Value *b) {
     case TYPE_EXCEPTION:
     case TYPE_BOUND_EXCEPTION:
         return !strcmp(a->value.exception, b->value.exception);
+    case TYPE_VECTOR:
+        if (a->value.vector.len != b->value.vector.len) return 0;
+        for (size_t i = 0; i < a->value.vector.len; i++) {
+            if (!values_equal(a->value.vector.items[i], b->value.vector.items[i])) return 0;
+        }
+        return 1;
+    case TYPE_F64VECTOR:
+        if (a->value.numvector.len != b->value.numvector.len) return 0;
+        for (size_t i = 0; i < a->value.numvector.len; i++) {
+            if (a->value.numvector.f64[i] != b->value.numvector.f64[i]) return 0;
+        }
+        return 1;
+    case TYPE_S64VECTOR:
+        if (a->value.numvector.len != b->value.numvector.len) return 0;
+        return !memcmp(a->value.numvector.s64, b->value.numvector.s64,
+                a->value.numvector.len * sizeof(int64_t));
+    case TYPE_BYTEVECTOR:
+        return bytevector_len(a) == bytevector_len(b)
+            && !memcmp(bytevector_data(a), bytevector_data(b), bytevector_len(a));
+    case TYPE_HASHTABLE:
+    case TYPE_PORT:
+    case TYPE_EOF:
+        return 0; // Only if identical
     case TYPE_NULL:
         return 1;
+    case TYPE_ENV:
+        break;
     }
 
     assert(0);
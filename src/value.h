@@ -4,10 +4,6 @@
 struct Value;
 typedef struct Value Value;
 
-#include <stdio.h>
-#include "env.h"
-#include "number.h"
-
 enum Type {
     TYPE_NULL = 0, // This is actually represented by a NULL ptr, not ->type == TYPE_NULL
     TYPE_ATOM,
@@ -21,53 +17,170 @@ enum Type {
     TYPE_EXCEPTION,
     TYPE_BOUND_EXCEPTION,
     TYPE_STRING,
+    TYPE_CHAR,
+    TYPE_MACRO, // Expands its calls before they are evaluated, see expand.c
+    TYPE_VECTOR,
+    TYPE_HASHTABLE, // see hashtable.c
+    TYPE_F64VECTOR, // see numvector.c
+    TYPE_S64VECTOR,
+    TYPE_PORT, // see port.c
+    TYPE_BYTEVECTOR,
+    TYPE_EOF, // only eof_object, what reading at the end of a port returns
+    TYPE_ENV, // Not a Value, marks environments in the heap, see gc.c
 };
 
+#include <stdint.h>
+#include <stdio.h>
+#include "env.h"
+#include "number.h"
+#include "port.h"
+
 extern const char *type_names[];
 
+// Statically allocated, returned with copy_value() like any other
+extern Value eof_object;
+
 struct List {
     Value *car;
     Value *cdr;
+    GlobalRef global; // for a variable in car, see resolve_cell()
 };
 
+struct Code;
+struct HashTable;
+
 struct Function {
     Value *operands, *body;
     Env *env;
+    struct Code *code; // body compiled for the VM, NULL until first needed
+};
+
+struct Vector {
+    Value **items;
+    size_t len;
+};
+
+// The items of an f64vector or s64vector, unboxed
+struct NumVector {
+    union {
+        double *f64;
+        int64_t *s64;
+    };
+    size_t len;
+};
+
+// The bytes of strings. Substrings share the buffer of the string they are
+// taken from, and concat appends to the room left after its first argument
+// when that ends the used bytes, so building a string piece by piece is
+// linear.
+struct StrBuf {
+    char *data; // a NUL follows the used bytes
+    size_t used, size;
+    int refs;
+};
+
+// Strings are immutable, their bytes are data[start] to data[start + len - 1]
+struct String {
+    struct StrBuf *buf;
+    size_t start, len;
+};
+
+// The bytes of bytevectors, allocated or a file mapped by read-file.
+// Slices are views sharing the buffer of the bytevector they are taken from.
+struct ByteBuf {
+    unsigned char *data;
+    size_t size;
+    int refs;
+    int mapped; // released with unmap_file()
+};
+
+struct Bytevector {
+    struct ByteBuf *buf;
+    size_t start, len;
 };
 
 typedef Value *(*Builtin)(Value *arg, Env *env);
 
 struct Value {
     enum Type type;
+
+    union {
+        // For list cells whose car is a variable: where it is bound, as found
+        // by resolve_lexical(). Depth is 1 + the number of frames up, 0 if
+        // unknown.
+        struct {
+            unsigned short ref_depth, ref_slot;
+        };
+
+        // For functions: the size of the frame for a call
+        int nslots;
+
+        // For atoms: set once the name is bound outside the global
+        // environment, until then it can only refer to a global
+        int local;
+    };
+
     union {
         char *atom;
         Number number;
         struct List list;
         struct Function func;
+        struct Vector vector;
+        struct NumVector numvector;
+        struct HashTable *hashtable;
+        struct Port *port;
         Builtin builtin;
-        int boolean;
         char *exception;
-        char *string;
+        struct String string;
+        struct Bytevector bytevector;
     } value;
 
     // Garbage collection
     int refs;
-    Value *gc_next;
-    Value *gc_prev;
+    unsigned gc; // scratch space for the collector
 };
 
-extern Value vtrue, vfalse;
-extern Value *gc_head;
+// Small values are not allocated, they are encoded in the pointer itself:
+//   ...xxxxxxx1  fixnum, the rest of the bits are the integer
+//   ...00000010  boolean, bit 8 is the value
+//   ...00001010  character, bits 8 and up are the character
+// Heap Values are at least 8 byte aligned so their low bits are clear.
+#define TAG_BOOLEAN 0x02
+#define TAG_CHAR    0x0a
+
+#define FIXNUM_MIN (INTPTR_MIN >> 1)
+#define FIXNUM_MAX (INTPTR_MAX >> 1)
+
+#define IS_HEAP(V) ((V) != NULL && !((uintptr_t)(V) & 3))
+#define IS_FIXNUM(V) ((uintptr_t)(V) & 1)
+#define FIXNUM(X) ((Value *)(((uintptr_t)(intptr_t)(X) << 1) | 1))
+#define FIXNUM_VALUE(V) ((intptr_t)(V) >> 1)
+#define CHAR(C) ((Value *)(((uintptr_t)(unsigned char)(C) << 8) | TAG_CHAR))
+#define CHAR_VALUE(V) ((unsigned char)((uintptr_t)(V) >> 8))
+
+#define TRUE  ((Value *)(0x100 | TAG_BOOLEAN))
+#define FALSE ((Value *)TAG_BOOLEAN)
+
+static inline enum Type type_of(Value *v) {
+    if (v == NULL) return TYPE_NULL;
+    if (IS_FIXNUM(v)) return TYPE_NUMBER;
+    if ((uintptr_t)v & 2) {
+        return ((uintptr_t)v & 0xff) == TAG_CHAR ? TYPE_CHAR : TYPE_BOOLEAN;
+    }
+    return v->type;
+}
 
-#define TYPEOF(V) ((V) == NULL ? TYPE_NULL : (V)->type)
-#define IS_LIST(V) ((V) == NULL || (V)->type == TYPE_LIST)
-#define IS_FUNCTION(V) ((V) != NULL && ((V)->type == TYPE_FUNCTION || (V)->type == TYPE_FUNCTION_SF))
-#define IS_BUILTIN(V) ((V) != NULL && ((V)->type == TYPE_BUILTIN || (V)->type == TYPE_BUILTIN_SF))
+#define TYPEOF(V) type_of(V)
+#define IS_LIST(V) ((V) == NULL || TYPEOF(V) == TYPE_LIST)
+#define IS_FUNCTION(V) (TYPEOF(V) == TYPE_FUNCTION || TYPEOF(V) == TYPE_FUNCTION_SF)
+#define IS_BUILTIN(V) (TYPEOF(V) == TYPE_BUILTIN || TYPEOF(V) == TYPE_BUILTIN_SF)
 #define IS_CALLABLE(V) (IS_FUNCTION(V) || IS_BUILTIN(V))
-#define IS_EXCEPTION(V) ((V) != NULL && ((V)->type == TYPE_EXCEPTION || (V)->type == TYPE_BOUND_EXCEPTION))
+#define IS_EXCEPTION(V) (TYPEOF(V) == TYPE_EXCEPTION || TYPEOF(V) == TYPE_BOUND_EXCEPTION)
 
-#define TRUE  (&vtrue)
-#define FALSE (&vfalse)
+static inline Number number_of(Value *v) {
+    if (IS_FIXNUM(v)) return create_number_ll(FIXNUM_VALUE(v));
+    return v->value.number;
+}
 
 Value *cons(Value *, Value *);
 Value *create_value(enum Type type);
@@ -77,35 +190,82 @@ Value *create_atom_alloced(char *str);
 Value *create_atom_list(const char **list, int len);
 Value *create_builtin(Builtin);
 Value *create_builtin_sf(Builtin);
-Value *create_string(char *str);
+Value *create_string(const char *str);
 Value *create_string_alloced(char *str);
+
+// A string of the len bytes at chars
+Value *create_string_len(const char *chars, size_t len);
+
+// The len bytes of string s from start, sharing its buffer
+Value *create_substring(Value *s, size_t start, size_t len);
+
+// A string of the len bytes at chars, made by overwriting string s if nothing
+// else refers to it or its buffer, so a loop can reuse one string. Takes s.
+Value *reuse_string(Value *s, const char *chars, size_t len);
+
+// A string of the strings in ls, one after the other
+Value *concat_strings(Value *ls);
+
+// The bytes of string s, NUL terminated. A substring that isn't is first
+// moved to a buffer of its own.
+const char *string_cstr(Value *s);
 Value *create_exception(const char *s, ...);
+
+// A vector of len items, each fill
+Value *create_vector(size_t len, Value *fill);
+
+// A vector of the items of ls
+Value *list_to_vector(Value *ls);
+
+// An f64vector or s64vector of len zeros
+Value *create_numvector(enum Type type, size_t len);
+
+// A bytevector of len zeros
+Value *create_bytevector(size_t len);
+
+// A bytevector of the size bytes from map_file() at data, which it takes
+Value *map_bytevector(const void *data, size_t size);
+
+// The len bytes of bytevector bv from start, sharing its buffer
+Value *create_byteslice(Value *bv, size_t start, size_t len);
 Value *copy_value(Value *v);
 int delete_value(Value *v);
 int values_equal(Value *, Value *);
 
-void track_value(Value *v);
-void untrack_value(Value *v);
-int is_tracked(Value *v);
+static inline const char *string_chars(Value *s) {
+    return s->value.string.buf->data + s->value.string.start;
+}
+
+static inline size_t string_len(Value *s) {
+    return s->value.string.len;
+}
+
+static inline unsigned char *bytevector_data(Value *bv) {
+    return bv->value.bytevector.buf->data + bv->value.bytevector.start;
+}
+
+static inline size_t bytevector_len(Value *bv) {
+    return bv->value.bytevector.len;
+}
 
 #define CAR(V) ((V)->value.list.car)
 #define CDR(V) ((V)->value.list.cdr)
 
 static inline Value *car(Value * v) {
-    if (v == NULL || v->type != TYPE_LIST) return v;
+    if (TYPEOF(v) != TYPE_LIST) return v;
     return CAR(v);
 }
 
 static inline Value *cdr(Value * v) {
-    if (v == NULL || v->type != TYPE_LIST) return NULL;
+    if (TYPEOF(v) != TYPE_LIST) return NULL;
     return CDR(v);
 }
 
 static inline void _debug(const char *name, Value *v) {
     void print(Value *);
-    printf("%s = ", name);
+    port_printf(current_output, "%s = ", name);
     print(v);
-    puts("");
+    port_putc(current_output, '\n');
 }
 
 #define debug(V) (_debug(#V, V))
@@ -0,0 +1,753 @@
+#include <stdlib.h>
+#include "builtins.h"
+#include "env.h"
+#include "expand.h"
+#include "interpreter.h"
+#include "symbol.h"
+#include "vm.h"
+
+// The VM keeps the temporaries of every call on one stack of values, and the
+// calls themselves on a stack of frames. Calls between compiled functions
+// don't recurse in C, tail calls replace the caller's frame.
+//
+// Everything on the stacks holds a reference, so values there are roots for
+// the collector like those on the C stack.
+
+#define STACK_SIZE (1 << 20)
+#define FRAMES_SIZE (1 << 18)
+
+// Dispatch jumps straight to the next instruction's label where the compiler
+// supports taking their address, see thread()
+#if defined(__GNUC__) && !defined(VM_SWITCH)
+#define THREADED
+#endif
+
+typedef struct {
+    Code *code;
+    intptr_t *pc;
+    Env *env;
+    Value *func; // being called, NULL at the top level
+    Value **base; // of its temporaries on the stack
+} Frame;
+
+static Value **stack, **stack_end;
+static Frame *frames, *frames_end;
+
+// The tops of both stacks while the VM is not running, it may be entered
+// again from a builtin
+static Value **stack_top;
+static Frame *frames_top;
+
+// Replaces opcodes with the addresses of their labels
+static void thread(Code *code, void **labels) {
+    for (int i = 0; i < code->len; ) {
+        intptr_t op = code->ops[i];
+        code->ops[i] = (intptr_t)labels[op];
+        i += 1 + op_operands[op];
+    }
+}
+
+static Handler *find_handler(Code *code, intptr_t *pc) {
+    int at = pc - code->ops - 1;
+
+    for (int i = 0; i < code->nhandlers; i++) {
+        if (code->handlers[i].start <= at && at < code->handlers[i].end) {
+            return &code->handlers[i];
+        }
+    }
+    return NULL;
+}
+
+// Turns the top n values of the stack into a list
+static Value *pop_list(Value **sp, int n) {
+    Value *ls = NULL;
+    for (int i = 1; i <= n; i++) {
+        ls = cons(sp[-i], ls);
+    }
+    return ls;
+}
+
+static int is_raised(Value *v) {
+    return TYPEOF(v) == TYPE_EXCEPTION;
+}
+
+// Creates the frame for calling func with the n arguments on top of the
+// stack. They are moved into the frame, whatever happens.
+static Value *bind_args(Value *func, Value **sp, int n, Env *env, Env **dst) {
+    static Value *rest = NULL;
+    if (rest == NULL) rest = intern("&rest");
+
+    Env *parent = func->type == TYPE_FUNCTION ? func->value.func.env : env;
+    Env *frame = create_frame(parent, func->nslots);
+    Value **arg = sp - n;
+    Value *param = func->value.func.operands;
+    EnvSlot *slot = frame->slots;
+
+    while (param != NULL) {
+        if (car(param) == rest) {
+            slot->name = car(cdr(param));
+            slot->value = pop_list(sp, sp - arg);
+            arg = sp;
+            param = NULL;
+            break;
+        }
+
+        if (arg == sp) break;
+
+        slot->name = car(param);
+        slot->value = *arg++;
+        slot += 1;
+        param = cdr(param);
+    }
+
+    if (arg != sp || param != NULL) {
+        while (arg < sp) delete_value(*arg++);
+        delete_env(frame);
+        return create_exception("argument/parameter mismatch");
+    }
+
+    *dst = frame;
+    return NULL;
+}
+
+static Value *call_builtin(Value *f, Value **sp, int n, Env *env) {
+    Value *args = pop_list(sp, n);
+    Value *ret = f->value.builtin(args, env);
+    delete_value(args);
+    return ret;
+}
+
+// Leaves an inlined builtin whose operator is no longer bound to it
+#define CHECK_BOUND(N) do { \
+        Global *g = &code->globals[pc[1]]; \
+        if (g->ref.version != env_version || g->ref.slot->value != consts[pc[0]]) { \
+            n = N; \
+            goto rebound; \
+        } \
+    } while (0)
+
+#define ARITH(OP, EXPR) \
+    CASE(OP) { \
+        Value *a = sp[-2], *b = sp[-1]; \
+        intptr_t r; \
+        CHECK_BOUND(2); \
+        if (IS_FIXNUM(a) && IS_FIXNUM(b) \
+                && !__builtin_ ## EXPR ## _overflow(FIXNUM_VALUE(a), FIXNUM_VALUE(b), &r) \
+                && r >= FIXNUM_MIN && r <= FIXNUM_MAX) { \
+            sp -= 1; \
+            sp[-1] = FIXNUM(r); \
+            pc += 2; \
+            DISPATCH(); \
+        } \
+        goto slow_builtin_2; \
+    }
+
+#define COMPARE(OP, CMP) \
+    CASE(OP) { \
+        Value *a = sp[-2], *b = sp[-1]; \
+        CHECK_BOUND(2); \
+        if (IS_FIXNUM(a) && IS_FIXNUM(b)) { \
+            sp -= 1; \
+            sp[-1] = FIXNUM_VALUE(a) CMP FIXNUM_VALUE(b) ? TRUE : FALSE; \
+            pc += 2; \
+            DISPATCH(); \
+        } \
+        goto slow_builtin_2; \
+    }
+
+// Runs code in env until it returns
+static Value *run(Code *code, Env *env) {
+#ifdef THREADED
+    static void *labels[] = {
+#define OP(NAME, OPERANDS) &&op_ ## NAME,
+#include "opcodes.def"
+#undef OP
+    };
+#define CASE(OP) op_ ## OP:
+#define DISPATCH() goto *(void *)*pc++
+#define ENTER(CODE) do { if (!(CODE)->threaded) { thread(CODE, labels); (CODE)->threaded = 1; } } while (0)
+#else
+#define CASE(OP) case OP_ ## OP:
+#define DISPATCH() goto dispatch
+#define ENTER(CODE) ((void)0)
+#endif
+
+    if (stack == NULL) {
+        stack = stack_top = malloc(STACK_SIZE * sizeof *stack);
+        stack_end = stack + STACK_SIZE;
+        frames = frames_top = malloc(FRAMES_SIZE * sizeof *frames);
+        frames_end = frames + FRAMES_SIZE;
+    }
+
+    Frame *entry = frames_top, *f = entry;
+    Value **sp = stack_top;
+    Value **consts;
+    intptr_t *pc;
+    Value *ret;
+
+    // Of the call being made
+    int n;
+    Value *func;
+    Code *callee;
+    Env *frame;
+
+    if (f + 1 >= frames_end || sp + code->max_depth >= stack_end) {
+        release_code(code);
+        return create_exception("Stack overflow");
+    }
+
+    ENTER(code);
+    f->code = code;
+    f->pc = code->ops;
+    f->env = copy_env(env);
+    f->func = NULL;
+    f->base = sp;
+
+// Before anything that may run the VM again
+#define SAVE() (f->pc = pc, stack_top = sp, frames_top = f + 1)
+
+#define LOAD() (code = f->code, consts = code->consts, pc = f->pc, env = f->env)
+
+#define PUSH(V) (*sp++ = (V))
+
+// Pushes the value of an expression, exceptions bubble up
+#define PUSH_RESULT(V) do { \
+        ret = (V); \
+        if (is_raised(ret)) goto raise; \
+        PUSH(ret); \
+    } while (0)
+
+    LOAD();
+
+#ifdef THREADED
+    DISPATCH();
+#else
+dispatch:
+    switch (*pc++) {
+#endif
+
+    CASE(CONST) {
+        PUSH(copy_value(consts[pc[0]]));
+        pc += 1;
+        DISPATCH();
+    }
+
+    CASE(LOCAL) {
+        Value *name = consts[pc[2]];
+        Env *e = env;
+        Value *v;
+
+        for (int i = 1; i < pc[0] && e != NULL; i++) {
+            // A define in an inner frame may shadow the parameter
+            if (e->first != NULL) goto slow_local;
+            e = e->parent;
+        }
+
+        if (e != NULL && pc[1] < e->size && e->slots[pc[1]].name == name) {
+            v = e->slots[pc[1]].value;
+        } else {
+slow_local:
+            if (!resolve(env, name, &v)) {
+                pc += 3;
+                ret = create_exception("Could not resolve '%s'", name->value.atom);
+                goto raise;
+            }
+        }
+
+        pc += 3;
+        PUSH_RESULT(copy_value(v));
+        DISPATCH();
+    }
+
+    CASE(GLOBAL) {
+        Global *g = &code->globals[pc[0]];
+        Value *v;
+
+        pc += 1;
+        if (g->ref.version == env_version) {
+            v = g->ref.slot->value;
+        } else if (!resolve_global(env, g->name, &g->ref, &v)) {
+            ret = create_exception("Could not resolve '%s'", g->name->value.atom);
+            goto raise;
+        }
+        PUSH_RESULT(copy_value(v));
+        DISPATCH();
+    }
+
+    CASE(DEFINE) {
+        add_to_env(env, consts[pc[0]], sp[-1]);
+        sp[-1] = NULL;
+        pc += 1;
+        DISPATCH();
+    }
+
+    CASE(SET) {
+        set_in_env(env, consts[pc[0]], sp[-1]);
+        sp[-1] = NULL;
+        pc += 1;
+        DISPATCH();
+    }
+
+    CASE(POP) {
+        delete_value(*--sp);
+        DISPATCH();
+    }
+
+    CASE(JUMP) {
+        pc = code->ops + pc[0];
+        DISPATCH();
+    }
+
+    CASE(JUMP_UNLESS_TRUE) {
+        Value *test = *--sp;
+
+        if (test == TRUE) {
+            pc += 1;
+        } else {
+            delete_value(test);
+            pc = code->ops + pc[0];
+        }
+        DISPATCH();
+    }
+
+    CASE(JUMP_IF_TRUE_OR_POP) {
+        if (sp[-1] == TRUE) {
+            pc = code->ops + pc[0];
+        } else {
+            delete_value(*--sp);
+            pc += 1;
+        }
+        DISPATCH();
+    }
+
+    CASE(JUMP_UNLESS_TRUE_OR_POP) {
+        if (sp[-1] != TRUE) {
+            pc = code->ops + pc[0];
+        } else {
+            sp -= 1;
+            pc += 1;
+        }
+        DISPATCH();
+    }
+
+    CASE(CLOSURE) {
+        Proto *proto = &code->protos[pc[0]];
+        Value *func = create_value(proto->type);
+
+        func->value.func.operands = copy_value(proto->operands);
+        func->value.func.body = copy_value(proto->body);
+        func->value.func.env = copy_env(env);
+        func->value.func.code = proto->code;
+        func->nslots = proto->nslots;
+        proto->code->refs += 1;
+
+        PUSH(func);
+        pc += 1;
+        DISPATCH();
+    }
+
+    CASE(SPECIAL) {
+        Value *f_val = sp[-1];
+        Value *operands = consts[pc[0]];
+        intptr_t *call = code->ops + pc[1];
+        int tail = pc[2];
+
+        pc += 3;
+        if (TYPEOF(f_val) == TYPE_BUILTIN_SF || TYPEOF(f_val) == TYPE_MACRO) {
+            sp -= 1;
+            SAVE();
+            if (f_val->type == TYPE_MACRO) {
+                // A call that was not there when the code was expanded
+                Value *expansion = apply_macro(f_val, operands);
+                ret = is_raised(expansion) ? expansion : vm_eval(expansion, env);
+                if (ret != expansion) delete_value(expansion);
+            } else {
+                ret = f_val->value.builtin(operands, env);
+                if (ret == TAIL) ret = eval_tail(env);
+            }
+            delete_value(f_val);
+
+            pc = call + 2;
+            if (is_raised(ret)) goto raise;
+            PUSH(ret);
+            if (tail) goto do_return;
+        } else if (TYPEOF(f_val) == TYPE_FUNCTION_SF) {
+            // The macro's arguments are its operands
+            for (Value *op = operands; TYPEOF(op) == TYPE_LIST; op = CDR(op)) {
+                PUSH(copy_value(CAR(op)));
+            }
+            pc = call;
+        }
+        DISPATCH();
+    }
+
+    CASE(FORM) {
+        Global *g = &code->globals[pc[1]];
+        Value *v;
+
+        if (g->ref.version == env_version && g->ref.slot->value == consts[pc[0]]) {
+            pc += 4;
+            DISPATCH();
+        }
+
+        // Rebound, or only resolved by name
+        resolve_global(env, g->name, &g->ref, &v);
+        if (v == consts[pc[0]]) {
+            pc += 4;
+            DISPATCH();
+        }
+
+        Value *x = consts[pc[2]];
+        if (pc[3] >= 0) {
+            SAVE();
+            ret = vm_eval(x, env);
+            if (is_raised(ret)) goto raise;
+            pc = code->ops + pc[3];
+            PUSH(ret);
+            DISPATCH();
+        }
+
+        // In tail position the form replaces the rest of the code, as the
+        // last line of eval does
+        callee = compile(x, env);
+        while (sp > f->base) delete_value(*--sp);
+        if (sp + callee->max_depth >= stack_end) {
+            release_code(callee);
+            ret = create_exception("Stack overflow");
+            goto raise;
+        }
+
+        ENTER(callee);
+        release_code(f->code);
+        f->code = callee;
+        f->pc = callee->ops;
+        LOAD();
+        DISPATCH();
+    }
+
+    CASE(CALL) {
+        n = pc[0];
+        pc += 1;
+call:
+        func = sp[-n - 1];
+
+        if (TYPEOF(func) == TYPE_BUILTIN) {
+            SAVE();
+            ret = call_builtin(func, sp, n, env);
+            sp -= n + 1;
+            delete_value(func);
+            PUSH_RESULT(ret);
+            DISPATCH();
+        } else if (!IS_FUNCTION(func)) {
+            goto not_applicable;
+        }
+
+        if (func->value.func.code == NULL) {
+            func->value.func.code = compile_function(func);
+        }
+        callee = func->value.func.code;
+
+        ret = bind_args(func, sp, n, env, &frame);
+        sp -= n + 1;
+        if (ret) {
+            delete_value(func);
+            goto raise;
+        }
+
+        if (f + 2 >= frames_end || sp + callee->max_depth >= stack_end) {
+            delete_env(frame);
+            delete_value(func);
+            ret = create_exception("Stack overflow");
+            goto raise;
+        }
+
+        f->pc = pc;
+        f += 1;
+
+        ENTER(callee);
+        callee->refs += 1;
+        f->code = callee;
+        f->pc = callee->ops;
+        f->env = frame;
+        f->func = func;
+        f->base = sp;
+        LOAD();
+        DISPATCH();
+    }
+
+    CASE(TAIL_CALL) {
+        n = pc[0];
+        func = sp[-n - 1];
+        pc += 1;
+
+        if (TYPEOF(func) == TYPE_BUILTIN && func->value.builtin == eval_block && n > 0) {
+            // eval: the last line replaces the caller's code, so loops
+            // written with macros that expand through eval don't recurse
+            SAVE();
+            ret = NULL;
+            for (int i = n; i > 1 && ret == NULL; i--) {
+                Value *line = expand(sp[-i], env);
+                ret = vm_eval(line, env);
+                delete_value(line);
+                if (!is_raised(ret)) {
+                    delete_value(ret);
+                    ret = NULL;
+                }
+            }
+
+            Value *last = expand(sp[-1], env);
+            while (sp > f->base) delete_value(*--sp);
+            if (ret) {
+                delete_value(last);
+                goto raise;
+            }
+
+            callee = compile(last, env);
+            delete_value(last);
+            if (sp + callee->max_depth >= stack_end) {
+                release_code(callee);
+                ret = create_exception("Stack overflow");
+                goto raise;
+            }
+
+            ENTER(callee);
+            release_code(f->code);
+            f->code = callee;
+            f->pc = callee->ops;
+            LOAD();
+            DISPATCH();
+        } else if (TYPEOF(func) == TYPE_BUILTIN) {
+            SAVE();
+            ret = call_builtin(func, sp, n, env);
+            sp -= n + 1;
+            delete_value(func);
+            if (is_raised(ret)) goto raise;
+            PUSH(ret);
+            goto do_return;
+        } else if (!IS_FUNCTION(func)) {
+            goto not_applicable;
+        }
+
+        if (func->value.func.code == NULL) {
+            func->value.func.code = compile_function(func);
+        }
+        callee = func->value.func.code;
+
+        ret = bind_args(func, sp, n, env, &frame);
+        sp -= n + 1;
+        if (ret) {
+            delete_value(func);
+            goto raise;
+        }
+
+        // Whatever is below the call is dead too
+        while (sp > f->base) delete_value(*--sp);
+
+        if (sp + callee->max_depth >= stack_end) {
+            delete_env(frame);
+            delete_value(func);
+            ret = create_exception("Stack overflow");
+            goto raise;
+        }
+
+        // The caller's frame is released unless something captured it
+        ENTER(callee);
+        callee->refs += 1;
+        release_code(f->code);
+        delete_env(f->env);
+        delete_value(f->func);
+        f->code = callee;
+        f->pc = callee->ops;
+        f->env = frame;
+        f->func = func;
+        LOAD();
+        DISPATCH();
+    }
+
+    CASE(RETURN) {
+do_return:
+        ret = *--sp;
+        while (sp > f->base) delete_value(*--sp);
+
+        release_code(f->code);
+        delete_env(f->env);
+        delete_value(f->func);
+
+        if (f == entry) goto done;
+
+        f -= 1;
+        LOAD();
+        PUSH_RESULT(ret);
+        DISPATCH();
+    }
+
+    CASE(CATCH) {
+        if (is_raised(sp[-1])) {
+            pc += 1;
+        } else {
+            pc = code->ops + pc[0];
+        }
+        DISPATCH();
+    }
+
+    CASE(APPLY_CATCH) {
+        Value *handler = sp[-1], *exception = sp[-2];
+
+        if (!IS_CALLABLE(handler)) {
+            sp -= 2;
+            delete_value(exception);
+            delete_value(handler);
+            ret = create_exception("second argument to try must be function, not ");
+            goto raise;
+        }
+
+        // Bind the exception so it won't bubble
+        exception->type = TYPE_BOUND_EXCEPTION;
+        sp[-2] = handler;
+        sp[-1] = exception;
+
+        n = 1;
+        goto call;
+    }
+
+    ARITH(ADD, add)
+    ARITH(SUB, sub)
+    COMPARE(LT, <)
+    COMPARE(GT, >)
+    COMPARE(LTE, <=)
+    COMPARE(GTE, >=)
+
+    CASE(NUM_EQ) {
+        Value *a = sp[-2], *b = sp[-1];
+
+        CHECK_BOUND(2);
+        if (IS_FIXNUM(a) && IS_FIXNUM(b)) {
+            sp -= 1;
+            sp[-1] = a == b ? TRUE : FALSE;
+            pc += 2;
+            DISPATCH();
+        }
+        goto slow_builtin_2;
+    }
+
+    CASE(CAR) {
+        Value *ls = sp[-1];
+
+        CHECK_BOUND(1);
+        if (TYPEOF(ls) == TYPE_LIST) {
+            sp[-1] = copy_value(CAR(ls));
+            delete_value(ls);
+            pc += 2;
+            DISPATCH();
+        }
+        goto slow_builtin_1;
+    }
+
+    CASE(CDR) {
+        Value *ls = sp[-1];
+
+        CHECK_BOUND(1);
+        if (TYPEOF(ls) == TYPE_LIST) {
+            sp[-1] = copy_value(CDR(ls));
+            delete_value(ls);
+            pc += 2;
+            DISPATCH();
+        }
+        goto slow_builtin_1;
+    }
+
+    CASE(CONS) {
+        CHECK_BOUND(2);
+        sp -= 1;
+        sp[-1] = cons(sp[-1], sp[0]);
+        pc += 2;
+        DISPATCH();
+    }
+
+    CASE(IS_NULL) {
+        Value *v = sp[-1];
+
+        CHECK_BOUND(1);
+        sp[-1] = v == NULL ? TRUE : FALSE;
+        delete_value(v);
+        pc += 2;
+        DISPATCH();
+    }
+
+#ifndef THREADED
+    }
+#endif
+
+    // The inlined builtins call the real one when the fast path doesn't apply
+slow_builtin_1:
+    n = 1;
+    goto slow_builtin;
+slow_builtin_2:
+    n = 2;
+slow_builtin:
+    SAVE();
+    ret = call_builtin(consts[pc[0]], sp, n, env);
+    sp -= n;
+    pc += 2;
+    PUSH_RESULT(ret);
+    DISPATCH();
+
+rebound: {
+        // The compiler saw the operator bound to the builtin, now it is
+        // looked up again and called like any other
+        Global *g = &code->globals[pc[1]];
+        Value *v;
+
+        if (!resolve_global(env, g->name, &g->ref, &v)) {
+            while (n-- > 0) delete_value(*--sp);
+            pc += 2;
+            ret = create_exception("Could not resolve '%s'", g->name->value.atom);
+            goto raise;
+        }
+        if (v == consts[pc[0]]) goto slow_builtin;
+
+        for (int i = 0; i < n; i++) sp[-i] = sp[-i - 1];
+        sp[-n] = copy_value(v);
+        sp += 1;
+        pc += 2;
+        goto call;
+    }
+
+not_applicable:
+    ret = create_exception("Cannot apply value of type %s", type_names[TYPEOF(func)]);
+    while (n-- >= 0) delete_value(*--sp);
+    goto raise;
+
+raise:
+    // ret is an exception, the value of the instruction before pc
+    for (;;) {
+        Handler *handler = find_handler(code, pc);
+
+        if (handler != NULL) {
+            while (sp > f->base + handler->depth) delete_value(*--sp);
+            PUSH(ret);
+            pc = code->ops + handler->target;
+            DISPATCH();
+        }
+
+        // Not handled in this function, so the call evaluates to it
+        while (sp > f->base) delete_value(*--sp);
+        release_code(f->code);
+        delete_env(f->env);
+        delete_value(f->func);
+
+        if (f == entry) goto done;
+
+        f -= 1;
+        LOAD();
+    }
+
+done:
+    stack_top = entry->base;
+    frames_top = entry;
+    return ret;
+}
+
+Value *vm_eval(Value *expr, Env *env) {
+    return run(compile(expr, env), env);
+}
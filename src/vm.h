@@ -0,0 +1,77 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+#include "value.h"
+
+// Bytecode engine, an alternative to the tree walking eval() selected with
+// -b. Expressions are compiled (compile.c) to instructions for a stack
+// machine (vm.c) that works on the same values and environments as eval(), so
+// the two can call each other: forms the compiler doesn't know are handed to
+// their builtins, and functions created by either run on both.
+
+enum Opcode {
+#define OP(NAME, OPERANDS) OP_ ## NAME,
+#include "opcodes.def"
+#undef OP
+};
+
+// Number of operand words of each instruction
+extern const int op_operands[];
+
+typedef struct Code Code;
+
+// A lambda or macro expression inside compiled code
+typedef struct {
+    Value *operands, *body;
+    enum Type type;
+    int nslots;
+    Code *code;
+} Proto;
+
+// A variable the code looks up in the global environment
+typedef struct {
+    Value *name;
+    GlobalRef ref;
+} Global;
+
+// Exceptions raised between start and end don't leave the expression being
+// compiled: the stack is cut back to depth and the exception is pushed as its
+// value, then execution continues at target
+typedef struct {
+    int start, end, target, depth;
+} Handler;
+
+struct Code {
+    int refs;
+    int threaded;   // opcodes have been replaced by the VM's labels
+
+    intptr_t *ops;  // opcodes, each followed by its operands
+    int len, size;
+    int max_depth;  // of the stack
+
+    Value **consts;
+    int nconsts, consts_size;
+
+    Proto *protos;
+    int nprotos, protos_size;
+
+    Global *globals;
+    int nglobals, globals_size;
+
+    Handler *handlers;
+    int nhandlers, handlers_size;
+};
+
+// Compiles expr, to be run in an environment whose global environment is the
+// root of env
+Code *compile(Value *expr, Env *env);
+
+// Compiles the body of a function that was created by eval()
+Code *compile_function(Value *func);
+
+void release_code(Code *code);
+
+Value *vm_eval(Value *expr, Env *env);
+
+#endif
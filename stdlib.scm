@@ -7,32 +7,40 @@
 
 (define (list &rest args) args)
 
-(define do eval)
+(define do begin)
 
 (define (map ls f)
   (cond ((null? ls) ())
         (#t (cons (f (car ls))
                   (map (cdr ls) f)))))
 
-(define let
-  (macro (lets body)
-         (eval
-           (cons
-             (list
-               (quote lambda)
-               (map lets car)
-               body)
-             (map lets (lambda (pair) (eval (car (cdr pair)))))))))
+; let and if are special forms of the interpreter, these definitions are
+; only used when it doesn't have them
+(cond
+  ((function? let) ())
+  (else
+    (define let
+      (macro (lets body)
+             (eval
+               (cons
+                 (list
+                   (quote lambda)
+                   (map lets car)
+                   body)
+                 (map lets (lambda (pair) (eval (car (cdr pair)))))))))))
 
 (define (is-defined? name)
   (try (let ((_ (eval name))) #t)
        (lambda (err) #f)))
 
-(define if
-  (macro (check yes no)
-    (let ((result (eval check)))
-      (cond (result (eval yes))
-            (else (eval no))))))
+(cond
+  ((function? if) ())
+  (else
+    (define if
+      (macro (check yes no)
+        (let ((result (eval check)))
+          (cond (result (eval yes))
+                (else (eval no))))))))
 
 (define (abs x)
   (cond ((< x 0) (- x))
@@ -48,22 +56,22 @@
   (accumulate-iter combiner null-value term a next b))
 
 (define (accumulate-iter combiner value term a next b)
-  (cond ((> a b) null-value)
+  (cond ((> a b) value)
         (else
           (accumulate-iter combiner (combiner (term a) value) term (next a) next b))))
 
 (define (identity x) x)
 
+; Appending to the end of acc reuses its buffer, so this is linear
 (define (ncat ls)
-  (cond ((null? ls) "")
+  (ncat-iter ls ""))
+
+(define (ncat-iter ls acc)
+  (cond ((null? ls) acc)
         ((number? (car ls))
-         (concat
-           (number->string (car ls))
-           (ncat (cdr ls))))
+         (ncat-iter (cdr ls) (concat acc (number->string (car ls)))))
         (else
-         (concat
-           (car ls)
-           (ncat (cdr ls))))))
+         (ncat-iter (cdr ls) (concat acc (car ls))))))
 
 (define current-test-name "<no-test>")
 
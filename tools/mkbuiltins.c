@@ -0,0 +1,56 @@
+// Generates src/builtin_table.h, a perfect hash of the names in
+// src/builtins.def. Built and run by Makefile.host.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/hash.h"
+
+#define MAX_SEEDS 1000000
+
+static const char *names[] = {
+#define BUILTIN(NAME, FUNC) NAME,
+#define SPECIAL_FORM(NAME, FUNC) NAME,
+#define CONSTANT(NAME, VALUE) NAME,
+#include "../src/builtins.def"
+};
+
+#define COUNT ((int)(sizeof names / sizeof names[0]))
+
+static int try_seed(unsigned seed, int bits, int *slots) {
+    for (int i = 0; i < 1 << bits; i++) slots[i] = -1;
+
+    for (int i = 0; i < COUNT; i++) {
+        unsigned h = hash_bytes(names[i], strlen(names[i]));
+        unsigned j = hash_index(h, seed, bits);
+        if (slots[j] >= 0) return 0;
+        slots[j] = i;
+    }
+    return 1;
+}
+
+int main(void) {
+    int bits = 1;
+    while (1 << bits < COUNT) bits++;
+
+    for (;; bits++) {
+        int *slots = malloc((1 << bits) * sizeof *slots);
+
+        for (unsigned seed = 0; seed < MAX_SEEDS; seed++) {
+            if (!try_seed(seed * 2654435761u, bits, slots)) continue;
+
+            printf("// Generated by tools/mkbuiltins.c from src/builtins.def, do not edit\n\n");
+            printf("#define BUILTIN_HASH_SEED 0x%08xu\n", seed * 2654435761u);
+            printf("#define BUILTIN_HASH_BITS %d\n\n", bits);
+            printf("// Index into builtins.def for each hash, -1 if none\n");
+            printf("static const short builtin_slots[1 << BUILTIN_HASH_BITS] = {");
+            for (int i = 0; i < 1 << bits; i++) {
+                printf("%s%d,", i % 16 ? " " : "\n    ", slots[i]);
+            }
+            printf("\n};\n");
+            return 0;
+        }
+
+        free(slots);
+    }
+}